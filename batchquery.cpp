@@ -0,0 +1,393 @@
+//batchquery.cpp
+
+/* Batch scheduler for path and reachability queries. See 'batchquery.h' for an overview. */
+
+#include "batchquery.h"
+#include <algorithm>
+#include <functional>
+
+
+/* FUNCTION: Constructor for the handle of a submitted batch. Takes the futures of every query.
+ * ARGUMENTS: The shared state of the batch.
+ * RETURN: Returns no values.
+ */
+batch_handle::batch_handle(shared_ptr<batch_state> to_track) : state(to_track)
+{
+    futures.reserve(state->promises.size());
+    for(unsigned int i = 0; i < state->promises.size(); ++i)
+        futures.push_back(state->promises[i].get_future());
+}
+
+
+/* FUNCTION: Waits for a batch to finish and summarizes how long its queries took.
+ * ARGUMENTS: No params.
+ * RETURN: The throughput and latency percentiles of the batch.
+ */
+batch_stats batch_handle::wait(void)
+{
+    unique_lock<mutex> guard(state->lock);
+    state->all_done.wait(guard, [this]{ return state->complete; });
+
+    batch_stats stats;
+    vector<double> sorted(state->latencies);
+    sort(sorted.begin(), sorted.end());
+
+    stats.queries = sorted.size();
+    stats.seconds = chrono::duration<double>(state->finished - state->submitted).count();
+    stats.throughput = stats.seconds > 0 ? stats.queries / stats.seconds : 0;
+    stats.median_latency = sorted.empty() ? 0 : sorted[sorted.size() / 2];
+    stats.p95_latency = sorted.empty() ? 0 : sorted[(sorted.size() - 1) * 95 / 100];
+    stats.p99_latency = sorted.empty() ? 0 : sorted[(sorted.size() - 1) * 99 / 100];
+    stats.max_latency = sorted.empty() ? 0 : sorted.back();
+    return stats;
+}
+
+
+/* FUNCTION: Constructor for the scheduler. Reads the passability of every cell and starts the workers.
+ * ARGUMENTS: The grid to search, a predicate that marks a cell value as impassable, and the number of
+ *            worker threads (0 picks one per hardware thread).
+ * RETURN: Returns no values.
+ */
+template<class T>
+batch_scheduler<T>::batch_scheduler(const gridgraph<T> & to_search, typename gridgraph<T>::cell_predicate blocked, unsigned int count)
+    : grid(to_search), is_blocked(blocked), rows(to_search.get_column_size()), columns(to_search.get_row_size()), pending(0), stopping(false)
+{
+    refresh();
+
+    if(count == 0)
+        count = max(1u, thread::hardware_concurrency());
+
+    for(unsigned int id = 0; id < count; ++id)
+    {
+        worker * next = new worker;
+        next->distance.resize(grid.get_size());
+        next->parent.resize(grid.get_size());
+        next->visited.assign(grid.get_size(), 0);
+        next->stamp = 0;
+        workers.push_back(next);
+    }
+    for(unsigned int id = 0; id < count; ++id)
+        workers[id]->runner = thread(&batch_scheduler<T>::work, this, id);
+}
+
+
+/* FUNCTION: Destructor for the scheduler. Lets the workers drain any queued queries, then joins them.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+batch_scheduler<T>::~batch_scheduler()
+{
+    {
+        lock_guard<mutex> guard(sleep_lock);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    //every worker may still be stealing from the others until it exits
+    for(unsigned int id = 0; id < workers.size(); ++id)
+        workers[id]->runner.join();
+    for(unsigned int id = 0; id < workers.size(); ++id)
+        delete workers[id];
+    workers.clear();
+}
+
+
+/* FUNCTION: Re-reads the passability of every cell from the grid. Must not run while a batch is in flight.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void batch_scheduler<T>::refresh(void)
+{
+    vector<T> values(grid.get_size());
+    grid.get_all_values(values.data());
+    open.resize(values.size());
+    for(unsigned int i = 0; i < values.size(); ++i)
+        open[i] = !is_blocked(values[i]);
+}
+
+
+/* FUNCTION: Queues a batch of queries. They are dealt round-robin onto the worker deques; idle workers
+ *           steal from busy ones, so uneven query costs still spread across the pool.
+ * ARGUMENTS: The queries, and an optional callback (with its context pointer) run as each one completes.
+ * RETURN: A handle holding one future per query and the batch statistics.
+ */
+template<class T>
+batch_handle batch_scheduler<T>::submit_batch(const vector<grid_query> & queries, query_callback done, void * context)
+{
+    shared_ptr<batch_state> batch(new batch_state);
+    batch->queries = queries;
+    batch->promises.resize(queries.size());
+    batch->latencies.assign(queries.size(), 0);
+    batch->done = done;
+    batch->context = context;
+    batch->remaining = queries.size();
+    batch->complete = queries.empty();
+    batch->submitted = chrono::steady_clock::now();
+    batch->finished = batch->submitted;
+
+    batch_handle handle(batch);
+    if(queries.empty())
+        return handle;
+
+    //count first so a worker can never see more tasks than pending
+    pending += queries.size();
+    unsigned int count = workers.size();
+    for(unsigned int id = 0; id < count; ++id)
+    {
+        lock_guard<mutex> guard(workers[id]->lock);
+        for(unsigned int index = id; index < queries.size(); index += count){
+            task next = {batch, index};
+            workers[id]->tasks.push_back(next);
+        }
+    }
+    {
+        lock_guard<mutex> guard(sleep_lock);
+    }
+    wake.notify_all();
+    return handle;
+}
+
+
+/* FUNCTION: Runs a batch to completion.
+ * ARGUMENTS: The queries and a vector that receives one result per query, in order.
+ * RETURN: The throughput and latency percentiles of the batch.
+ */
+template<class T>
+batch_stats batch_scheduler<T>::run_batch(const vector<grid_query> & queries, vector<query_result> & results)
+{
+    batch_handle handle = submit_batch(queries);
+    results.resize(queries.size());
+    for(unsigned int i = 0; i < handle.size(); ++i)
+        results[i] = handle.result(i).get();
+    return handle.wait();
+}
+
+
+/* FUNCTION: Main loop of a worker thread. Answers queued queries until the scheduler stops.
+ * ARGUMENTS: The id of the worker.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void batch_scheduler<T>::work(unsigned int id)
+{
+    worker & self = *workers[id];
+    for(;;)
+    {
+        task next;
+        if(take(id, next))
+        {
+            batch_state & batch = *next.batch;
+            query_result result;
+            answer(self, batch.queries[next.index], result);
+
+            chrono::steady_clock::time_point now = chrono::steady_clock::now();
+            result.latency = chrono::duration<double>(now - batch.submitted).count();
+            batch.latencies[next.index] = result.latency;
+            if(batch.done)
+                batch.done(next.index, result, batch.context);
+            batch.promises[next.index].set_value(result);
+
+            if(batch.remaining.fetch_sub(1) == 1)
+            {
+                lock_guard<mutex> guard(batch.lock);
+                batch.finished = now;
+                batch.complete = true;
+                batch.all_done.notify_all();
+            }
+            continue;
+        }
+
+        unique_lock<mutex> guard(sleep_lock);
+        wake.wait(guard, [this]{ return stopping || pending > 0; });
+        if(stopping && pending == 0)
+            return;
+    }
+}
+
+
+/* FUNCTION: Takes the next task for a worker: the front of its own deque, or else the back of the
+ *           first other deque that has work.
+ * ARGUMENTS: The id of the worker and a task that receives the work.
+ * RETURN: True if a task was found.
+ */
+template<class T>
+bool batch_scheduler<T>::take(unsigned int id, task & next)
+{
+    unsigned int count = workers.size();
+    for(unsigned int k = 0; k < count; ++k)
+    {
+        worker & victim = *workers[(id + k) % count];
+        lock_guard<mutex> guard(victim.lock);
+        if(victim.tasks.empty())
+            continue;
+
+        if(k == 0){
+            next = victim.tasks.front();
+            victim.tasks.pop_front();
+        } else {
+            next = victim.tasks.back();
+            victim.tasks.pop_back();
+        }
+        --pending;
+        return true;
+    }
+    return false;
+}
+
+
+/* FUNCTION: Answers one query with a worker's scratch arrays.
+ * ARGUMENTS: The worker, the query, and the result to fill.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void batch_scheduler<T>::answer(worker & scratch, const grid_query & query, query_result & result)
+{
+    result.reachable = false;
+    result.length = NO_PATH;
+    result.path.clear();
+
+    unsigned int size = open.size();
+    if(query.source >= size || query.target >= size || !open[query.source] || !open[query.target])
+        return;
+
+    //stamps make clearing the visited array unnecessary, except once every 2^32 queries
+    if(++scratch.stamp == 0){
+        fill(scratch.visited.begin(), scratch.visited.end(), 0);
+        scratch.stamp = 1;
+    }
+
+    if(query.mode == QUERY_PATH)
+        a_star(scratch, query.source, query.target, result);
+    else
+        breadth_first(scratch, query.source, query.target, result);
+}
+
+
+/* FUNCTION: Breadth-first search that stops as soon as the target is reached.
+ * ARGUMENTS: The worker, the source and target positions, and the result to fill.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void batch_scheduler<T>::breadth_first(worker & scratch, unsigned int source, unsigned int target, query_result & result)
+{
+    vector<unsigned int> & queue = scratch.frontier;
+    queue.clear();
+    queue.push_back(source);
+    scratch.visited[source] = scratch.stamp;
+    scratch.distance[source] = 0;
+
+    for(unsigned int head = 0; head < queue.size(); ++head)
+    {
+        unsigned int current = queue[head];
+        if(current == target){
+            result.reachable = true;
+            result.length = scratch.distance[current];
+            return;
+        }
+
+        unsigned int adjacent[4];
+        unsigned int count = neighbours(current, adjacent);
+        for(unsigned int i = 0; i < count; ++i)
+        {
+            unsigned int next = adjacent[i];
+            if(scratch.visited[next] == scratch.stamp || !open[next])
+                continue;
+            scratch.visited[next] = scratch.stamp;
+            scratch.distance[next] = scratch.distance[current] + 1;
+            queue.push_back(next);
+        }
+    }
+}
+
+
+/* FUNCTION: A* search with the Manhattan heuristic. Fills the path from source to target.
+ * ARGUMENTS: The worker, the source and target positions, and the result to fill.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void batch_scheduler<T>::a_star(worker & scratch, unsigned int source, unsigned int target, query_result & result)
+{
+    typedef unsigned long long entry;
+    vector<entry> & heap = scratch.open_set;
+    greater<entry> order;
+    heap.clear();
+
+    scratch.visited[source] = scratch.stamp;
+    scratch.distance[source] = 0;
+    scratch.parent[source] = source;
+    heap.push_back(((entry) heuristic(source, target) << 32) | source);
+
+    while(!heap.empty())
+    {
+        pop_heap(heap.begin(), heap.end(), order);
+        unsigned int current = (unsigned int) heap.back();
+        unsigned int estimate = (unsigned int) (heap.back() >> 32);
+        heap.pop_back();
+
+        unsigned int cost = scratch.distance[current];
+        if(estimate > cost + heuristic(current, target))
+            continue; //stale entry
+
+        if(current == target)
+        {
+            result.reachable = true;
+            result.length = cost;
+            result.path.resize(cost + 1);
+            for(unsigned int at = target, i = cost + 1; i > 0; at = scratch.parent[at])
+                result.path[--i] = at;
+            return;
+        }
+
+        unsigned int adjacent[4];
+        unsigned int count = neighbours(current, adjacent);
+        for(unsigned int i = 0; i < count; ++i)
+        {
+            unsigned int next = adjacent[i];
+            if(!open[next] || (scratch.visited[next] == scratch.stamp && scratch.distance[next] <= cost + 1))
+                continue;
+            scratch.visited[next] = scratch.stamp;
+            scratch.distance[next] = cost + 1;
+            scratch.parent[next] = current;
+            heap.push_back(((entry) (cost + 1 + heuristic(next, target)) << 32) | next);
+            push_heap(heap.begin(), heap.end(), order);
+        }
+    }
+}
+
+
+/* FUNCTION: Lists the cells directly adjacent to a position, the same adjacency the gridgraph tabulates.
+ * ARGUMENTS: The grid position and an array of at least 4 entries that receives the neighbours.
+ * RETURN: The number of neighbours.
+ */
+template<class T>
+unsigned int batch_scheduler<T>::neighbours(unsigned int position, unsigned int * adjacent) const
+{
+    unsigned int row = position / columns;
+    unsigned int column = position % columns;
+    unsigned int count = 0;
+    if(column + 1 < columns) adjacent[count++] = position + 1;
+    if(row > 0)              adjacent[count++] = position - columns;
+    if(column > 0)           adjacent[count++] = position - 1;
+    if(row + 1 < rows)       adjacent[count++] = position + columns;
+    return count;
+}
+
+
+/* FUNCTION: Manhattan distance between two grid positions.
+ * ARGUMENTS: The two grid positions.
+ * RETURN: The estimated number of steps.
+ */
+template<class T>
+unsigned int batch_scheduler<T>::heuristic(unsigned int from, unsigned int to) const
+{
+    unsigned int from_row = from / columns, from_column = from % columns;
+    unsigned int to_row = to / columns, to_column = to % columns;
+    return (from_row > to_row ? from_row - to_row : to_row - from_row)
+         + (from_column > to_column ? from_column - to_column : to_column - from_column);
+}
+
+
+
+template class batch_scheduler<char>;
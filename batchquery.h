@@ -0,0 +1,145 @@
+//batchquery.h
+
+/* Batch scheduler for many independent path and reachability queries against one read-only gridgraph.
+ * The passability of every cell is read from the grid once (and again on refresh()); the grid itself is
+ * never written. Queries run on a pool of worker threads. Each worker owns a deque of tasks and steals
+ * from the others when its own deque is empty. Each worker also has its own distance, parent and
+ * visited scratch arrays, which are reused from one query to the next. Results come back through
+ * futures, an optional completion callback, or both, and every batch reports its throughput and
+ * latency percentiles. */
+
+#ifndef BATCHQUERY_H
+#define BATCHQUERY_H
+
+#include "gridgraph.h"
+#include <vector>
+#include <deque>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+
+enum query_mode { QUERY_PATH, QUERY_REACHABLE };
+
+struct grid_query
+{
+    unsigned int source; //grid positions (row * columns + column)
+    unsigned int target;
+    query_mode mode;
+};
+
+struct query_result
+{
+    bool reachable;
+    unsigned int length;         //number of steps, or NO_PATH
+    vector<unsigned int> path;   //grid positions, filled for QUERY_PATH only
+    double latency;              //seconds from batch submission to completion
+};
+
+struct batch_stats
+{
+    unsigned int queries;
+    double seconds;              //wall time from submission to the last completion
+    double throughput;           //queries per second
+    double median_latency;
+    double p95_latency;
+    double p99_latency;
+    double max_latency;
+};
+
+typedef void (*query_callback)(unsigned int index, const query_result & result, void * context);
+
+
+struct batch_state
+{
+    vector<grid_query> queries;
+    vector< promise<query_result> > promises;
+    vector<double> latencies;
+    query_callback done;
+    void * context;
+
+    chrono::steady_clock::time_point submitted;
+    chrono::steady_clock::time_point finished;
+    atomic<unsigned int> remaining;
+    bool complete;
+    mutex lock;
+    condition_variable all_done;
+};
+
+
+class batch_handle
+{
+    public:
+        batch_handle(shared_ptr<batch_state> state);
+
+        unsigned int size(void) const { return futures.size(); }
+        future<query_result> & result(unsigned int index) { return futures[index]; }
+        batch_stats wait(void); //blocks until every query of the batch has completed
+
+    private:
+        shared_ptr<batch_state> state;
+        vector< future<query_result> > futures;
+};
+
+
+template<class T>
+class batch_scheduler
+{
+    public:
+        batch_scheduler(const gridgraph<T> & grid, typename gridgraph<T>::cell_predicate is_blocked, unsigned int workers = 0);
+        ~batch_scheduler();
+
+        void refresh(void); //re-read passability after the grid was written; call between batches
+
+        batch_handle submit_batch(const vector<grid_query> & queries, query_callback done = NULL, void * context = NULL);
+        batch_stats run_batch(const vector<grid_query> & queries, vector<query_result> & results);
+
+        unsigned int get_worker_count(void) const { return workers.size(); }
+
+    private:
+        struct task
+        {
+            shared_ptr<batch_state> batch;
+            unsigned int index;
+        };
+
+        struct worker
+        {
+            deque<task> tasks;
+            mutex lock;
+            thread runner;
+
+            vector<unsigned int> distance; //scratch, sized to the grid
+            vector<unsigned int> parent;
+            vector<unsigned int> visited;  //holds the stamp of the query that last reached each cell
+            vector<unsigned int> frontier;
+            vector<unsigned long long> open_set; //A* heap of (estimate << 32 | position)
+            unsigned int stamp;
+        };
+
+        const gridgraph<T> & grid;
+        typename gridgraph<T>::cell_predicate is_blocked;
+        vector<unsigned char> open;
+        unsigned int rows;
+        unsigned int columns;
+
+        vector<worker *> workers;
+        mutex sleep_lock;
+        condition_variable wake;
+        atomic<unsigned int> pending;
+        bool stopping;
+
+        void work(unsigned int id);
+        bool take(unsigned int id, task & next);
+        void answer(worker & scratch, const grid_query & query, query_result & result);
+        void breadth_first(worker & scratch, unsigned int source, unsigned int target, query_result & result);
+        void a_star(worker & scratch, unsigned int source, unsigned int target, query_result & result);
+        unsigned int neighbours(unsigned int position, unsigned int * adjacent) const;
+        unsigned int heuristic(unsigned int from, unsigned int to) const;
+};
+
+#endif
@@ -0,0 +1,485 @@
+//gridaggregate.cpp
+
+/* Rectangle aggregate indexes over a gridgraph. See 'gridaggregate.h' for an overview. */
+
+#include "gridaggregate.h"
+#include <thread>
+#include <algorithm>
+#include <functional>
+
+
+/* FUNCTION: Constructor for the shared part of the rectangle indexes. Attaches the index to the grid.
+ * ARGUMENTS: The grid to index and an optional predicate for the cells rect_matching counts.
+ * RETURN: Returns no values.
+ */
+template<class T>
+rectangle_index<T>::rectangle_index(gridgraph<T> & to_index, typename gridgraph<T>::cell_predicate predicate)
+    : grid(to_index), counted(predicate), rows(to_index.get_column_size()), columns(to_index.get_row_size())
+{
+    grid.attach_observer(this);
+}
+
+
+/* FUNCTION: Destructor for the shared part of the rectangle indexes. Detaches the index from the grid.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+rectangle_index<T>::~rectangle_index()
+{
+    grid.detach_observer(this);
+}
+
+
+/* FUNCTION: Counts the cells of a rectangle that lie inside the grid.
+ * ARGUMENTS: The top-left corner and size of the rectangle.
+ * RETURN: The number of cells.
+ */
+template<class T>
+unsigned int rectangle_index<T>::rect_count(unsigned int top, unsigned int left, unsigned int height, unsigned int width) const
+{
+    if(!clip(top, left, height, width))
+        return 0;
+    return height * width;
+}
+
+
+/* FUNCTION: Averages the cell values of a rectangle.
+ * ARGUMENTS: The top-left corner and size of the rectangle.
+ * RETURN: The mean value, or 0 for an empty rectangle.
+ */
+template<class T>
+double rectangle_index<T>::rect_average(unsigned int top, unsigned int left, unsigned int height, unsigned int width)
+{
+    unsigned int count = rect_count(top, left, height, width);
+    return count ? (double) rect_sum(top, left, height, width) / count : 0;
+}
+
+
+/* FUNCTION: Trims a rectangle to the grid.
+ * ARGUMENTS: The top-left corner, and the height and width to trim.
+ * RETURN: False if nothing of the rectangle is left.
+ */
+template<class T>
+bool rectangle_index<T>::clip(unsigned int top, unsigned int left, unsigned int & height, unsigned int & width) const
+{
+    if(top >= rows || left >= columns)
+        return false;
+    height = min(height, rows - top);
+    width = min(width, columns - left);
+    return height && width;
+}
+
+
+
+/* FUNCTION: Constructor for the summed-area table. Builds the table straight away.
+ * ARGUMENTS: The grid to index, an optional predicate for rect_matching, and the number of threads
+ *            used to build the table (0 picks one per hardware thread).
+ * RETURN: Returns no values.
+ */
+template<class T>
+summed_area_table<T>::summed_area_table(gridgraph<T> & to_index, typename gridgraph<T>::cell_predicate predicate, unsigned int count)
+    : rectangle_index<T>(to_index, predicate), threads(count ? count : max(1u, thread::hardware_concurrency())), stale(true)
+{
+    rebuild();
+}
+
+
+/* FUNCTION: Destructor for the summed-area table. No dynamic memory beyond its vectors.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+summed_area_table<T>::~summed_area_table()
+{}
+
+
+/* FUNCTION: Observer hooks. Any write leaves the table stale until the next query. Writers only set the
+ *           flag, so they never wait on a rebuild.
+ * ARGUMENTS: The changed cell or rectangle.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void summed_area_table<T>::value_changed(unsigned int row, unsigned int column, T old_value, T new_value)
+{
+    stale.store(true, memory_order_release);
+}
+
+template<class T>
+void summed_area_table<T>::region_changed(unsigned int top, unsigned int left, unsigned int height, unsigned int width)
+{
+    stale.store(true, memory_order_release);
+}
+
+
+/* FUNCTION: Sums the cell values of a rectangle with four table lookups.
+ * ARGUMENTS: The top-left corner and size of the rectangle.
+ * RETURN: The sum.
+ */
+template<class T>
+long long summed_area_table<T>::rect_sum(unsigned int top, unsigned int left, unsigned int height, unsigned int width)
+{
+    if(!this->clip(top, left, height, width))
+        return 0;
+    lock_guard<mutex> hold(this->guard);
+    refresh();
+
+    unsigned int stride = this->columns + 1;
+    unsigned int bottom = top + height, right = left + width;
+    return sums[bottom * stride + right] - sums[top * stride + right] - sums[bottom * stride + left] + sums[top * stride + left];
+}
+
+
+/* FUNCTION: Counts the cells of a rectangle that match the predicate, with four table lookups.
+ * ARGUMENTS: The top-left corner and size of the rectangle.
+ * RETURN: The number of matching cells.
+ */
+template<class T>
+unsigned int summed_area_table<T>::rect_matching(unsigned int top, unsigned int left, unsigned int height, unsigned int width)
+{
+    if(!this->counted || !this->clip(top, left, height, width))
+        return 0;
+    lock_guard<mutex> hold(this->guard);
+    refresh();
+
+    unsigned int stride = this->columns + 1;
+    unsigned int bottom = top + height, right = left + width;
+    return matches[bottom * stride + right] - matches[top * stride + right] - matches[bottom * stride + left] + matches[top * stride + left];
+}
+
+
+/* FUNCTION: Rebuilds the table from the grid now, whether or not it is stale.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void summed_area_table<T>::rebuild(void)
+{
+    lock_guard<mutex> hold(this->guard);
+    stale.store(false, memory_order_release);
+    build_table();
+}
+
+
+/* FUNCTION: Rebuilds the table if a write marked it stale. The caller holds the mutex, so only one
+ *           query rebuilds; the others wait and then find the flag clear. The flag is cleared before
+ *           the grid is read, so a write that lands during the rebuild marks the table stale again.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void summed_area_table<T>::refresh(void)
+{
+    if(stale.load(memory_order_acquire) && stale.exchange(false, memory_order_acq_rel))
+        build_table();
+}
+
+
+/* FUNCTION: Builds the table from the grid in two parallel passes: prefix sums along each row (split
+ *           into bands of rows), then running sums down the columns (split into bands of columns). The
+ *           second pass adds whole rows element by element, which the compiler can vectorize. The
+ *           caller holds the mutex.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void summed_area_table<T>::build_table(void)
+{
+    unsigned int rows = this->rows, columns = this->columns;
+    vector<T> values(rows * columns);
+    this->grid.get_all_values(values.data());
+
+    sums.assign((rows + 1) * (columns + 1), 0);
+    if(this->counted)
+        matches.assign((rows + 1) * (columns + 1), 0);
+
+    unsigned int workers = min(threads, max(1u, min(rows, columns)));
+    if(workers == 1){
+        prefix_rows(values, 0, rows);
+        prefix_columns(1, columns + 1);
+        return;
+    }
+
+    vector<thread> pool;
+    for(unsigned int w = 0; w < workers; ++w)
+        pool.push_back(thread(&summed_area_table<T>::prefix_rows, this, ref(values), rows * w / workers, rows * (w + 1) / workers));
+    for(unsigned int w = 0; w < workers; ++w)
+        pool[w].join();
+
+    pool.clear();
+    for(unsigned int w = 0; w < workers; ++w)
+        pool.push_back(thread(&summed_area_table<T>::prefix_columns, this, 1 + columns * w / workers, 1 + columns * (w + 1) / workers));
+    for(unsigned int w = 0; w < workers; ++w)
+        pool[w].join();
+}
+
+
+/* FUNCTION: First pass of the rebuild: prefix sums along a band of rows.
+ * ARGUMENTS: The grid values, and the first and one-past-last grid row of the band.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void summed_area_table<T>::prefix_rows(const vector<T> & values, unsigned int first, unsigned int last)
+{
+    unsigned int columns = this->columns, stride = columns + 1;
+    for(unsigned int row = first; row < last; ++row)
+    {
+        const T * in = values.data() + row * columns;
+        long long * out = sums.data() + (row + 1) * stride;
+        for(unsigned int column = 0; column < columns; ++column)
+            out[column + 1] = out[column] + (long long) in[column];
+
+        if(this->counted){
+            unsigned int * matched = matches.data() + (row + 1) * stride;
+            for(unsigned int column = 0; column < columns; ++column)
+                matched[column + 1] = matched[column] + (this->counted(in[column]) ? 1 : 0);
+        }
+    }
+}
+
+
+/* FUNCTION: Second pass of the rebuild: running sums down a band of table columns.
+ * ARGUMENTS: The first and one-past-last table column of the band.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void summed_area_table<T>::prefix_columns(unsigned int first, unsigned int last)
+{
+    unsigned int stride = this->columns + 1;
+    for(unsigned int row = 2; row <= this->rows; ++row)
+    {
+        long long * __restrict out = sums.data() + row * stride;
+        const long long * __restrict above = out - stride;
+        for(unsigned int column = first; column < last; ++column)
+            out[column] += above[column];
+
+        if(this->counted){
+            unsigned int * __restrict matched = matches.data() + row * stride;
+            const unsigned int * __restrict matched_above = matched - stride;
+            for(unsigned int column = first; column < last; ++column)
+                matched[column] += matched_above[column];
+        }
+    }
+}
+
+
+
+/* FUNCTION: Constructor for the Fenwick index. Builds the trees straight away.
+ * ARGUMENTS: The grid to index and an optional predicate for rect_matching.
+ * RETURN: Returns no values.
+ */
+template<class T>
+fenwick_index<T>::fenwick_index(gridgraph<T> & to_index, typename gridgraph<T>::cell_predicate predicate)
+    : rectangle_index<T>(to_index, predicate)
+{
+    rebuild();
+}
+
+
+/* FUNCTION: Destructor for the Fenwick index. No dynamic memory beyond its vectors.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+fenwick_index<T>::~fenwick_index()
+{}
+
+
+/* FUNCTION: Observer hook for a single write: brings the cell up to date in the trees.
+ * ARGUMENTS: The changed cell, and its value before and after (unused, see refresh_cell).
+ * RETURN: Returns no values.
+ */
+template<class T>
+void fenwick_index<T>::value_changed(unsigned int row, unsigned int column, T old_value, T new_value)
+{
+    lock_guard<mutex> hold(this->guard);
+    refresh_cell(row, column);
+}
+
+
+/* FUNCTION: Observer hook for a rectangle write. Small rectangles are refreshed cell by cell; large
+ *           ones rebuild the trees in linear time.
+ * ARGUMENTS: The changed rectangle.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void fenwick_index<T>::region_changed(unsigned int top, unsigned int left, unsigned int height, unsigned int width)
+{
+    lock_guard<mutex> hold(this->guard);
+    if((unsigned long long) height * width * 8 > (unsigned long long) this->rows * this->columns){
+        build_trees();
+        return;
+    }
+
+    for(unsigned int row = top; row < top + height; ++row)
+        for(unsigned int column = left; column < left + width; ++column)
+            refresh_cell(row, column);
+}
+
+
+/* FUNCTION: Re-reads a cell and adds the difference from the value the trees hold for it. The hook of
+ *           the last write to a cell runs after that write, so the trees end up with the final value
+ *           whatever order the hooks arrived in. The caller holds the mutex.
+ * ARGUMENTS: The cell.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void fenwick_index<T>::refresh_cell(unsigned int row, unsigned int column)
+{
+    T & held = applied[row * this->columns + column];
+    T value = this->grid.get_value_at_cord(row, column);
+    if(value == held)
+        return;
+    add(sums, row, column, (long long) value - (long long) held);
+    if(this->counted)
+        add(matches, row, column, (this->counted(value) ? 1 : 0) - (this->counted(held) ? 1 : 0));
+    held = value;
+}
+
+
+/* FUNCTION: Sums the cell values of a rectangle.
+ * ARGUMENTS: The top-left corner and size of the rectangle.
+ * RETURN: The sum.
+ */
+template<class T>
+long long fenwick_index<T>::rect_sum(unsigned int top, unsigned int left, unsigned int height, unsigned int width)
+{
+    if(!this->clip(top, left, height, width))
+        return 0;
+    lock_guard<mutex> hold(this->guard);
+    return rectangle(sums, top, left, height, width);
+}
+
+
+/* FUNCTION: Counts the cells of a rectangle that match the predicate.
+ * ARGUMENTS: The top-left corner and size of the rectangle.
+ * RETURN: The number of matching cells.
+ */
+template<class T>
+unsigned int fenwick_index<T>::rect_matching(unsigned int top, unsigned int left, unsigned int height, unsigned int width)
+{
+    if(!this->counted || !this->clip(top, left, height, width))
+        return 0;
+    lock_guard<mutex> hold(this->guard);
+    return rectangle(matches, top, left, height, width);
+}
+
+
+/* FUNCTION: Rebuilds both trees from the grid.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void fenwick_index<T>::rebuild(void)
+{
+    lock_guard<mutex> hold(this->guard);
+    build_trees();
+}
+
+
+/* FUNCTION: Does the rebuild for rebuild and region_changed. The caller holds the mutex.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void fenwick_index<T>::build_trees(void)
+{
+    unsigned int rows = this->rows, columns = this->columns, stride = columns + 1;
+    applied.resize(rows * columns);
+    this->grid.get_all_values(applied.data());
+    const vector<T> & values = applied;
+
+    sums.assign((rows + 1) * stride, 0);
+    if(this->counted)
+        matches.assign((rows + 1) * stride, 0);
+
+    for(unsigned int row = 0; row < rows; ++row)
+        for(unsigned int column = 0; column < columns; ++column)
+        {
+            T value = values[row * columns + column];
+            sums[(row + 1) * stride + column + 1] = value;
+            if(this->counted)
+                matches[(row + 1) * stride + column + 1] = this->counted(value) ? 1 : 0;
+        }
+
+    build(sums);
+    if(this->counted)
+        build(matches);
+}
+
+
+/* FUNCTION: Adds an amount to one cell of a tree.
+ * ARGUMENTS: The tree, the (0-based) cell, and the amount.
+ * RETURN: Returns no values.
+ */
+template<class T>
+template<class C>
+void fenwick_index<T>::add(vector<C> & tree, unsigned int row, unsigned int column, C amount)
+{
+    unsigned int stride = this->columns + 1;
+    for(unsigned int i = row + 1; i <= this->rows; i += i & -i)
+        for(unsigned int j = column + 1; j <= this->columns; j += j & -j)
+            tree[i * stride + j] += amount;
+}
+
+
+/* FUNCTION: Sums a tree over the rectangle [0, row) x [0, column).
+ * ARGUMENTS: The tree and the exclusive bottom-right corner.
+ * RETURN: The sum.
+ */
+template<class T>
+template<class C>
+C fenwick_index<T>::prefix(const vector<C> & tree, unsigned int row, unsigned int column) const
+{
+    unsigned int stride = this->columns + 1;
+    C total = 0;
+    for(unsigned int i = row; i > 0; i -= i & -i)
+        for(unsigned int j = column; j > 0; j -= j & -j)
+            total += tree[i * stride + j];
+    return total;
+}
+
+
+/* FUNCTION: Sums a tree over a rectangle from four prefix sums.
+ * ARGUMENTS: The tree and the top-left corner and size of the (already clipped) rectangle.
+ * RETURN: The sum.
+ */
+template<class T>
+template<class C>
+C fenwick_index<T>::rectangle(const vector<C> & tree, unsigned int top, unsigned int left, unsigned int height, unsigned int width) const
+{
+    unsigned int bottom = top + height, right = left + width;
+    return prefix(tree, bottom, right) - prefix(tree, top, right) - prefix(tree, bottom, left) + prefix(tree, top, left);
+}
+
+
+/* FUNCTION: Turns a table of cell values into a 2D Fenwick tree in linear time: each entry is pushed
+ *           into its parent along the row, then each row is pushed into its parent row.
+ * ARGUMENTS: The tree, holding cell values at 1-based positions.
+ * RETURN: Returns no values.
+ */
+template<class T>
+template<class C>
+void fenwick_index<T>::build(vector<C> & tree)
+{
+    unsigned int rows = this->rows, columns = this->columns, stride = columns + 1;
+    for(unsigned int i = 1; i <= rows; ++i)
+        for(unsigned int j = 1; j <= columns; ++j){
+            unsigned int parent = j + (j & -j);
+            if(parent <= columns)
+                tree[i * stride + parent] += tree[i * stride + j];
+        }
+
+    for(unsigned int i = 1; i <= rows; ++i){
+        unsigned int parent = i + (i & -i);
+        if(parent <= rows)
+            for(unsigned int j = 1; j <= columns; ++j)
+                tree[parent * stride + j] += tree[i * stride + j];
+    }
+}
+
+
+
+template class rectangle_index<char>;
+template class summed_area_table<char>;
+template class fenwick_index<char>;
@@ -0,0 +1,109 @@
+//gridaggregate.h
+
+/* Rectangle aggregate indexes over a gridgraph. Both attach to the grid as observers, so every write
+ * through set_value_at_cord, the region and bulk setters, or the atomic cell operations keeps them in
+ * step. Each answers the sum of the cell values in a rectangle and, if a predicate was given, how
+ * many cells in it match.
+ *
+ *   summed_area_table - O(1) queries. A write only marks the table stale; it is rebuilt in parallel
+ *                       on the next query. Best for grids that are read far more often than written.
+ *   fenwick_index     - O(log^2 N) queries and O(log^2 N) point updates. Best for grids under a
+ *                       steady stream of writes.
+ *
+ * Both may be queried from any number of threads while others write to the grid. Each index holds
+ * its own mutex around updates and queries, so a query never sees a half-applied write or a
+ * half-built table. Writers notify side by side and in no fixed order, so the Fenwick index keeps the
+ * value it last applied for every cell and re-reads a changed cell rather than trust the delta. */
+
+#ifndef GRIDAGGREGATE_H
+#define GRIDAGGREGATE_H
+
+#include "gridgraph.h"
+#include <vector>
+#include <atomic>
+#include <mutex>
+
+
+template<class T>
+class rectangle_index : public grid_observer<T>
+{
+    public:
+        rectangle_index(gridgraph<T> & grid, typename gridgraph<T>::cell_predicate counted);
+        virtual ~rectangle_index();
+
+        virtual long long rect_sum(unsigned int top, unsigned int left, unsigned int height, unsigned int width) = 0;
+        virtual unsigned int rect_matching(unsigned int top, unsigned int left, unsigned int height, unsigned int width) = 0;
+
+        unsigned int rect_count(unsigned int top, unsigned int left, unsigned int height, unsigned int width) const;
+        double rect_average(unsigned int top, unsigned int left, unsigned int height, unsigned int width);
+
+    protected:
+        gridgraph<T> & grid;
+        typename gridgraph<T>::cell_predicate counted; //may be NULL, in which case nothing matches
+        unsigned int rows;
+        unsigned int columns;
+        mutex guard; //held around every update and query of the derived data
+
+        bool clip(unsigned int top, unsigned int left, unsigned int & height, unsigned int & width) const;
+};
+
+
+template<class T>
+class summed_area_table : public rectangle_index<T>
+{
+    public:
+        summed_area_table(gridgraph<T> & grid, typename gridgraph<T>::cell_predicate counted = NULL, unsigned int threads = 0);
+        ~summed_area_table();
+
+        void value_changed(unsigned int row, unsigned int column, T old_value, T new_value);
+        void region_changed(unsigned int top, unsigned int left, unsigned int height, unsigned int width);
+
+        long long rect_sum(unsigned int top, unsigned int left, unsigned int height, unsigned int width);
+        unsigned int rect_matching(unsigned int top, unsigned int left, unsigned int height, unsigned int width);
+
+        void rebuild(void);
+        bool is_stale(void) const { return stale.load(memory_order_acquire); }
+
+    private:
+        vector<long long> sums;        //(rows + 1) * (columns + 1), first row and column are zero
+        vector<unsigned int> matches;
+        unsigned int threads;
+        atomic<bool> stale;            //set by writers without the mutex, cleared under it
+
+        void refresh(void);
+        void build_table(void);
+
+        void prefix_rows(const vector<T> & values, unsigned int first, unsigned int last);
+        void prefix_columns(unsigned int first, unsigned int last);
+};
+
+
+template<class T>
+class fenwick_index : public rectangle_index<T>
+{
+    public:
+        fenwick_index(gridgraph<T> & grid, typename gridgraph<T>::cell_predicate counted = NULL);
+        ~fenwick_index();
+
+        void value_changed(unsigned int row, unsigned int column, T old_value, T new_value);
+        void region_changed(unsigned int top, unsigned int left, unsigned int height, unsigned int width);
+
+        long long rect_sum(unsigned int top, unsigned int left, unsigned int height, unsigned int width);
+        unsigned int rect_matching(unsigned int top, unsigned int left, unsigned int height, unsigned int width);
+
+        void rebuild(void);
+
+    private:
+        vector<long long> sums;        //1-based trees, (rows + 1) * (columns + 1)
+        vector<int> matches;
+        vector<T> applied;             //the value the trees hold for each cell
+
+        template<class C> void add(vector<C> & tree, unsigned int row, unsigned int column, C amount);
+        template<class C> C prefix(const vector<C> & tree, unsigned int row, unsigned int column) const;
+        template<class C> C rectangle(const vector<C> & tree, unsigned int top, unsigned int left, unsigned int height, unsigned int width) const;
+        template<class C> void build(vector<C> & tree);
+        void build_trees(void);
+        void refresh_cell(unsigned int row, unsigned int column);
+};
+
+#endif
@@ -0,0 +1,92 @@
+//gridarena.cpp
+
+/* A bump (arena) memory resource for gridgraph storage. See 'gridarena.h' for an overview. */
+
+#include "gridarena.h"
+#include <new>
+#include <sys/mman.h>
+
+
+const size_t BLOCK_ALIGNMENT = 64; //heap blocks start on a cache line
+
+
+/* FUNCTION: Constructor for the arena. Reserves the whole block at once.
+ * ARGUMENTS: The size of the block in bytes, whether to back it with huge pages, and the resource to
+ *            fall back to once the block is used up.
+ * RETURN: Returns no values.
+ */
+grid_arena::grid_arena(size_t bytes, bool huge_pages, std::pmr::memory_resource * upstream)
+    : capacity(bytes ? bytes : 1), huge(huge_pages), mapped(false), block(reserve()), bump(block, capacity, upstream)
+{}
+
+
+/* FUNCTION: Destructor for the arena. Releases every allocation and the block in one go.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+grid_arena::~grid_arena()
+{
+    bump.release();
+    if(mapped)
+        munmap(block, capacity);
+    else
+        ::operator delete(block, std::align_val_t(BLOCK_ALIGNMENT));
+}
+
+
+/* FUNCTION: Carves the next piece off the block.
+ * ARGUMENTS: The number of bytes and their alignment.
+ * RETURN: The allocated memory.
+ */
+void * grid_arena::do_allocate(size_t bytes, size_t alignment)
+{
+    return bump.allocate(bytes, alignment);
+}
+
+
+/* FUNCTION: Arena memory is only given back when the arena is destroyed.
+ * ARGUMENTS: Ignored.
+ * RETURN: Returns no values.
+ */
+void grid_arena::do_deallocate(void * pointer, size_t bytes, size_t alignment)
+{}
+
+
+/* FUNCTION: Two arenas are only interchangeable if they are the same arena.
+ * ARGUMENTS: The other resource.
+ * RETURN: True if both are this arena.
+ */
+bool grid_arena::do_is_equal(const std::pmr::memory_resource & other) const noexcept
+{
+    return this == &other;
+}
+
+
+/* FUNCTION: Reserves the block. With huge pages, the size is rounded up to whole huge pages and the
+ *           kernel is asked to back the mapping with them (explicit huge pages first, then transparent
+ *           ones). Without huge pages, or if mapping fails, the block comes from the heap.
+ * ARGUMENTS: No params. Uses the capacity and huge page flag set in the constructor.
+ * RETURN: The start of the block.
+ */
+void * grid_arena::reserve(void)
+{
+#ifdef __linux__
+    if(huge)
+    {
+        size_t rounded = (capacity + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        void * pages = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(pages == MAP_FAILED){
+            pages = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(pages != MAP_FAILED)
+                madvise(pages, rounded, MADV_HUGEPAGE);
+        }
+        if(pages != MAP_FAILED){
+            capacity = rounded;
+            mapped = true;
+            return pages;
+        }
+    }
+#endif
+    huge = false;
+    return ::operator new(capacity, std::align_val_t(BLOCK_ALIGNMENT));
+}
@@ -0,0 +1,44 @@
+//gridarena.h
+
+/* A bump (arena) memory resource for gridgraph storage. The whole arena is reserved up front as one
+ * block, allocations are carved out of it in order, and nothing is freed until the arena itself is
+ * destroyed, which releases the block in one call. On Linux the block can be mapped with huge pages
+ * to cut TLB misses on multi-gigabyte grids. If the block runs out, further allocations fall through
+ * to an upstream resource. */
+
+#ifndef GRIDARENA_H
+#define GRIDARENA_H
+
+#include <cstddef>
+#include <memory_resource>
+
+
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+class grid_arena : public std::pmr::memory_resource
+{
+    public:
+        grid_arena(size_t bytes, bool huge_pages = false, std::pmr::memory_resource * upstream = std::pmr::get_default_resource());
+        ~grid_arena();
+
+        size_t get_capacity(void) const { return capacity; }
+        bool uses_huge_pages(void) const { return huge; }
+
+    protected:
+        void * do_allocate(size_t bytes, size_t alignment);
+        void do_deallocate(void * pointer, size_t bytes, size_t alignment);
+        bool do_is_equal(const std::pmr::memory_resource & other) const noexcept;
+
+    private:
+        grid_arena(const grid_arena &);
+
+        size_t capacity;
+        bool huge;
+        bool mapped;
+        void * block;
+        std::pmr::monotonic_buffer_resource bump;
+
+        void * reserve(void);
+};
+
+#endif
@@ -0,0 +1,161 @@
+//gridcsr.cpp
+
+/* Compressed sparse row view of a gridgraph's adjacency. See 'gridcsr.h' for an overview. */
+
+#include "gridcsr.h"
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+
+
+const unsigned int CSR_ROWS_PER_THREAD = 64; //each build thread gets at least this many rows
+
+
+/* FUNCTION: Constructor for the CSR view. Takes a snapshot of the grid, counts every vertex's degree
+ *           in parallel, turns the counts into offsets, then fills the neighbours (and weights) in
+ *           parallel straight into arrays of the exact size.
+ * ARGUMENTS: The grid, 4- or 8-connectivity, the predicate for blocked cells (NULL blocks nothing),
+ *            the edge weight function (NULL for no weights), and the number of threads (0 picks one
+ *            per hardware thread).
+ * RETURN: Returns no values.
+ */
+template<class T>
+csr_adjacency<T>::csr_adjacency(const gridgraph<T> & grid, grid_connectivity connect, typename gridgraph<T>::cell_predicate blocked,
+                                edge_weight weigh, unsigned int threads)
+    : rows(grid.get_column_size()), columns(grid.get_row_size()), connectivity(connect), is_blocked(blocked), weight(weigh)
+{
+    size_t cells = (size_t) rows * columns;
+    vector<T> values(cells);
+    grid.get_all_values(values.data());
+    vector<char> open(cells, 1);
+    if(is_blocked)
+        for(size_t i = 0; i < cells; ++i)
+            open[i] = !is_blocked(values[i]);
+
+    if(!threads)
+        threads = max(1u, thread::hardware_concurrency());
+    unsigned int bands = max(1u, min(threads, rows / CSR_ROWS_PER_THREAD));
+    vector<unsigned int> first_row(bands + 1);
+    for(unsigned int band = 0; band <= bands; ++band)
+        first_row[band] = (unsigned long long) rows * band / bands;
+
+    //pass 1: degrees, left in offsets[v + 1], and the edge total of each band
+    offsets.assign(cells + 1, 0);
+    vector<size_t> totals(bands, 0);
+    vector<thread> pool;
+    for(unsigned int band = 1; band < bands; ++band)
+        pool.push_back(thread(&csr_adjacency<T>::count_band, this, cref(open), first_row[band], first_row[band + 1], ref(totals[band])));
+    count_band(open, first_row[0], first_row[1], totals[0]);
+    for(unsigned int i = 0; i < pool.size(); ++i)
+        pool[i].join();
+
+    vector<size_t> base(bands, 0);
+    for(unsigned int band = 1; band < bands; ++band)
+        base[band] = base[band - 1] + totals[band - 1];
+    size_t edges = base[bands - 1] + totals[bands - 1];
+    neighbours.resize(edges);
+    if(weight)
+        weights.resize(edges);
+
+    //pass 2: each band turns its degrees into offsets from its base, then writes its edges
+    pool.clear();
+    for(unsigned int band = 1; band < bands; ++band)
+        pool.push_back(thread(&csr_adjacency<T>::fill_band, this, cref(values), cref(open), first_row[band], first_row[band + 1], base[band]));
+    fill_band(values, open, first_row[0], first_row[1], base[0]);
+    for(unsigned int i = 0; i < pool.size(); ++i)
+        pool[i].join();
+}
+
+
+/* FUNCTION: Lists a cell's open neighbours in ascending position order.
+ * ARGUMENTS: Which cells are open, the cell, and an array of up to eight positions to fill.
+ * RETURN: The number of neighbours, 0 for a blocked cell.
+ */
+template<class T>
+unsigned int csr_adjacency<T>::adjacent(const vector<char> & open, unsigned int row, unsigned int column, unsigned int * found) const
+{
+    size_t position = (size_t) row * columns + column;
+    if(!open[position])
+        return 0;
+
+    bool up = row > 0 && open[position - columns];
+    bool down = row + 1 < rows && open[position + columns];
+    bool left = column > 0 && open[position - 1];
+    bool right = column + 1 < columns && open[position + 1];
+    bool diagonal = connectivity == CONNECT_8;
+
+    unsigned int count = 0;
+    if(diagonal && up && left && open[position - columns - 1])
+        found[count++] = position - columns - 1;
+    if(up)
+        found[count++] = position - columns;
+    if(diagonal && up && right && open[position - columns + 1])
+        found[count++] = position - columns + 1;
+    if(left)
+        found[count++] = position - 1;
+    if(right)
+        found[count++] = position + 1;
+    if(diagonal && down && left && open[position + columns - 1])
+        found[count++] = position + columns - 1;
+    if(down)
+        found[count++] = position + columns;
+    if(diagonal && down && right && open[position + columns + 1])
+        found[count++] = position + columns + 1;
+    return count;
+}
+
+
+/* FUNCTION: First pass over a band of rows: stores each vertex's degree in offsets[v + 1].
+ * ARGUMENTS: Which cells are open, the first and one-past-last row, and where to put the band's total.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void csr_adjacency<T>::count_band(const vector<char> & open, unsigned int first, unsigned int last, size_t & total)
+{
+    unsigned int found[8];
+    size_t sum = 0;
+    for(unsigned int row = first; row < last; ++row)
+        for(unsigned int column = 0; column < columns; ++column){
+            unsigned int degree = adjacent(open, row, column, found);
+            offsets[(size_t) row * columns + column + 1] = degree;
+            sum += degree;
+        }
+    total = sum;
+}
+
+
+/* FUNCTION: Second pass over a band of rows: turns the degrees into offsets and writes the edges.
+ * ARGUMENTS: The cell values, which cells are open, the first and one-past-last row, and the offset of
+ *            the band's first edge.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void csr_adjacency<T>::fill_band(const vector<T> & values, const vector<char> & open, unsigned int first, unsigned int last, size_t base)
+{
+    //offsets[first vertex] belongs to the band above, so this band only writes the slots after its vertices
+    size_t edge = base;
+    for(size_t vertex = (size_t) first * columns; vertex < (size_t) last * columns; ++vertex){
+        base += offsets[vertex + 1];
+        offsets[vertex + 1] = base;
+    }
+
+    unsigned int found[8];
+    for(unsigned int row = first; row < last; ++row)
+        for(unsigned int column = 0; column < columns; ++column)
+        {
+            size_t vertex = (size_t) row * columns + column;
+            unsigned int count = adjacent(open, row, column, found);
+            for(unsigned int k = 0; k < count; ++k, ++edge){
+                neighbours[edge] = found[k];
+                if(weight){
+                    bool diagonal = found[k] % columns != column && found[k] / columns != row;
+                    weights[edge] = weight(values[vertex], values[found[k]]) * (diagonal ? M_SQRT2 : 1.0);
+                }
+            }
+        }
+}
+
+
+
+template class csr_adjacency<char>;
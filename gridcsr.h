@@ -0,0 +1,59 @@
+//gridcsr.h
+
+/* Compressed sparse row (CSR) view of a gridgraph's adjacency, for handing the grid to external
+ * graph libraries. Vertex v is the cell at array position v; its neighbours are
+ * neighbours[offsets[v]] up to neighbours[offsets[v + 1]], in ascending order, with a matching weight
+ * for each if a weight function was given.
+ *
+ * The view is 4-connected (right, up, left, down) or 8-connected (diagonals too). A diagonal is only
+ * an edge if both cells it passes between are open, so paths never squeeze through a corner. Blocked
+ * cells keep their vertex but have no edges in or out. Weights come from the two cell values of the
+ * edge; diagonal weights are scaled by sqrt(2).
+ *
+ * The view is built from one snapshot of the grid in two parallel passes over bands of rows: the
+ * first counts each vertex's degree, which sizes the arrays exactly, and the second fills them in.
+ * It does not follow later writes; build a new one instead. */
+
+#ifndef GRIDCSR_H
+#define GRIDCSR_H
+
+#include "gridgraph.h"
+#include <vector>
+
+
+enum grid_connectivity { CONNECT_4 = 4, CONNECT_8 = 8 };
+
+template<class T>
+class csr_adjacency
+{
+    public:
+        typedef double (*edge_weight)(T from, T to);
+
+        csr_adjacency(const gridgraph<T> & grid, grid_connectivity connectivity = CONNECT_4,
+                      typename gridgraph<T>::cell_predicate is_blocked = NULL, edge_weight weight = NULL, unsigned int threads = 0);
+
+        unsigned int get_vertex_count(void) const { return offsets.size() - 1; }
+        size_t get_edge_count(void) const { return neighbours.size(); }
+        unsigned int get_degree(unsigned int vertex) const { return offsets[vertex + 1] - offsets[vertex]; }
+
+        const vector<size_t> & get_offsets(void) const { return offsets; }
+        const vector<unsigned int> & get_neighbours(void) const { return neighbours; }
+        const vector<double> & get_weights(void) const { return weights; } //empty without a weight function
+
+    private:
+        unsigned int rows;
+        unsigned int columns;
+        grid_connectivity connectivity;
+        typename gridgraph<T>::cell_predicate is_blocked;
+        edge_weight weight;
+
+        vector<size_t> offsets;          //vertex count + 1
+        vector<unsigned int> neighbours; //edge count
+        vector<double> weights;          //edge count, or empty
+
+        unsigned int adjacent(const vector<char> & open, unsigned int row, unsigned int column, unsigned int * found) const;
+        void count_band(const vector<char> & open, unsigned int first, unsigned int last, size_t & total);
+        void fill_band(const vector<T> & values, const vector<char> & open, unsigned int first, unsigned int last, size_t base);
+};
+
+#endif
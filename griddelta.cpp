@@ -0,0 +1,192 @@
+//griddelta.cpp
+
+/* Dirty-region tracking for a gridgraph. See 'griddelta.h' for an overview. */
+
+#include "griddelta.h"
+#include <algorithm>
+
+
+/* FUNCTION: Constructor for the tracker. Splits the grid into tiles, all clean at version 0, and
+ *           attaches to the grid.
+ * ARGUMENTS: The grid to track and the side of a tile in cells.
+ * RETURN: Returns no values.
+ */
+template<class T>
+dirty_tracker<T>::dirty_tracker(gridgraph<T> & to_track, unsigned int size)
+    : grid(to_track), tile_size(size ? size : DELTA_TILE_SIZE),
+      tile_rows((to_track.get_column_size() + tile_size - 1) / tile_size),
+      tile_columns((to_track.get_row_size() + tile_size - 1) / tile_size),
+      issued(0), version(0), tile_versions(tile_rows * tile_columns), dirty((tile_rows * tile_columns + 63) / 64)
+{
+    for(unsigned int i = 0; i < tile_versions.size(); ++i)
+        tile_versions[i].store(0, memory_order_relaxed);
+    for(unsigned int i = 0; i < dirty.size(); ++i)
+        dirty[i].store(0, memory_order_relaxed);
+    grid.attach_observer(this);
+}
+
+
+/* FUNCTION: Destructor for the tracker. Detaches it from the grid.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+dirty_tracker<T>::~dirty_tracker()
+{
+    grid.detach_observer(this);
+}
+
+
+/* FUNCTION: Observer hook for a single write. Marks the cell's tile.
+ * ARGUMENTS: The changed cell and its old and new values.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void dirty_tracker<T>::value_changed(unsigned int row, unsigned int column, T old_value, T new_value)
+{
+    mark(row / tile_size, column / tile_size, row / tile_size, column / tile_size);
+}
+
+
+/* FUNCTION: Observer hook for a rectangle write. Marks every tile the rectangle overlaps.
+ * ARGUMENTS: The changed rectangle.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void dirty_tracker<T>::region_changed(unsigned int top, unsigned int left, unsigned int height, unsigned int width)
+{
+    if(height == 0 || width == 0)
+        return;
+    mark(top / tile_size, left / tile_size, (top + height - 1) / tile_size, (left + width - 1) / tile_size);
+}
+
+
+/* FUNCTION: Counts the tiles marked since the last take_delta.
+ * ARGUMENTS: No params.
+ * RETURN: The number of dirty tiles.
+ */
+template<class T>
+unsigned int dirty_tracker<T>::get_dirty_count(void) const
+{
+    unsigned int count = 0;
+    for(unsigned int i = 0; i < dirty.size(); ++i)
+        count += __builtin_popcountll(dirty[i].load(memory_order_relaxed));
+    return count;
+}
+
+
+/* FUNCTION: Collects the patches that bring a copy taken at some version up to date. Marks are left
+ *           alone, so each consumer can keep its own version.
+ * ARGUMENTS: The version the consumer's copy is at (0 for a fresh copy of a default grid), and the
+ *            vector to add the patches to.
+ * RETURN: The version to pass next time.
+ */
+template<class T>
+unsigned long long dirty_tracker<T>::get_delta(unsigned long long since, vector< grid_patch<T> > & patches) const
+{
+    unsigned long long current = version.load(memory_order_acquire);
+    vector<bool> selected(tile_versions.size());
+    for(unsigned int i = 0; i < tile_versions.size(); ++i)
+        selected[i] = tile_versions[i].load(memory_order_acquire) > since;
+    add_patches(selected, patches);
+    return current;
+}
+
+
+/* FUNCTION: Collects the patches for every tile marked since the last call and clears the marks.
+ * ARGUMENTS: The vector to add the patches to.
+ * RETURN: The version the patches bring a copy up to.
+ */
+template<class T>
+unsigned long long dirty_tracker<T>::take_delta(vector< grid_patch<T> > & patches)
+{
+    unsigned long long current = version.load(memory_order_acquire);
+    vector<bool> selected(tile_versions.size());
+    for(unsigned int word = 0; word < dirty.size(); ++word)
+    {
+        //clear before reading the values: a write that lands after this marks the tile again
+        unsigned long long bits = dirty[word].exchange(0, memory_order_acq_rel);
+        while(bits){
+            selected[word * 64 + __builtin_ctzll(bits)] = true;
+            bits &= bits - 1;
+        }
+    }
+    add_patches(selected, patches);
+    return current;
+}
+
+
+/* FUNCTION: Writes patches into a grid, e.g. a replica kept in sync with get_delta or take_delta.
+ * ARGUMENTS: The grid to write to (the same size as the tracked grid) and the patches.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void dirty_tracker<T>::apply_delta(gridgraph<T> & target, const vector< grid_patch<T> > & patches)
+{
+    for(unsigned int i = 0; i < patches.size(); ++i)
+        target.set_region_values(patches[i].values.data(), patches[i].top, patches[i].left, patches[i].height, patches[i].width);
+}
+
+
+/* FUNCTION: Stamps a rectangle of tiles with a new version, sets their dirty bits, then publishes the
+ *           version. A tile's version only ever goes up, even when two writers race to stamp it.
+ * ARGUMENTS: The first and last tile row and column, inclusive.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void dirty_tracker<T>::mark(unsigned int top, unsigned int left, unsigned int bottom, unsigned int right)
+{
+    bottom = min(bottom, tile_rows - 1);
+    right = min(right, tile_columns - 1);
+    unsigned long long stamp = issued.fetch_add(1, memory_order_relaxed) + 1;
+
+    for(unsigned int row = top; row <= bottom; ++row)
+        for(unsigned int column = left; column <= right; ++column)
+        {
+            unsigned int tile = row * tile_columns + column;
+            unsigned long long seen = tile_versions[tile].load(memory_order_relaxed);
+            while(seen < stamp && !tile_versions[tile].compare_exchange_weak(seen, stamp, memory_order_release, memory_order_relaxed))
+                ;
+            dirty[tile / 64].fetch_or(1ULL << (tile % 64), memory_order_release);
+        }
+
+    //publish in stamp order, so every write up to get_version() has finished marking its tiles
+    unsigned long long previous = stamp - 1;
+    while(!version.compare_exchange_weak(previous, stamp, memory_order_release, memory_order_relaxed))
+        previous = stamp - 1;
+}
+
+
+/* FUNCTION: Turns a set of tiles into patches, joining neighbouring tiles in a row of tiles into one
+ *           rectangle and reading its values from the grid in one region read.
+ * ARGUMENTS: One flag per tile, and the vector to add the patches to.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void dirty_tracker<T>::add_patches(const vector<bool> & selected, vector< grid_patch<T> > & patches) const
+{
+    unsigned int rows = grid.get_column_size(), columns = grid.get_row_size();
+    for(unsigned int row = 0; row < tile_rows; ++row)
+        for(unsigned int column = 0; column < tile_columns; ++column)
+        {
+            if(!selected[row * tile_columns + column])
+                continue;
+            unsigned int last = column;
+            while(last + 1 < tile_columns && selected[row * tile_columns + last + 1])
+                ++last;
+
+            patches.push_back(grid_patch<T>());
+            grid_patch<T> & patch = patches.back();
+            patch.top = row * tile_size;
+            patch.left = column * tile_size;
+            patch.height = min(tile_size, rows - patch.top);
+            patch.width = min((last + 1) * tile_size, columns) - patch.left;
+            patch.values.resize(patch.height * patch.width);
+            grid.get_region_values(patch.values.data(), patch.top, patch.left, patch.height, patch.width);
+            column = last;
+        }
+}
+
+
+
+template class dirty_tracker<char>;
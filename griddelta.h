@@ -0,0 +1,69 @@
+//griddelta.h
+
+/* Dirty-region tracking for a gridgraph, so consumers can copy only what changed instead of re-reading
+ * the whole grid with get_all_values. The tracker attaches to the grid as an observer and splits it
+ * into square tiles. Every write (single cell, region, bulk or atomic) bumps a version counter,
+ * stamps the tiles it touched with the new version and sets their bits in a dirty bitmap.
+ *
+ * Changes come back as patches: rectangles of values, one per run of neighbouring changed tiles in a
+ * row of tiles. There are two ways to ask for them:
+ *   get_delta  - every tile written after a given version. Any number of consumers can each keep
+ *                their own version; nothing is cleared.
+ *   take_delta - every tile marked since the last take_delta, clearing the marks.
+ * Both return the version the patches bring a copy up to. apply_delta writes patches into another
+ * grid of the same size. Marks are atomic, so writers on several threads may share one tracker;
+ * a write racing a delta is always included in the next one. */
+
+#ifndef GRIDDELTA_H
+#define GRIDDELTA_H
+
+#include "gridgraph.h"
+#include <vector>
+#include <atomic>
+
+
+const unsigned int DELTA_TILE_SIZE = 16; //tiles are 16 by 16 cells
+
+template<class T>
+struct grid_patch
+{
+    unsigned int top;
+    unsigned int left;
+    unsigned int height;
+    unsigned int width;
+    vector<T> values; //height * width values, row by row
+};
+
+template<class T>
+class dirty_tracker : public grid_observer<T>
+{
+    public:
+        dirty_tracker(gridgraph<T> & grid, unsigned int tile_size = DELTA_TILE_SIZE);
+        ~dirty_tracker();
+
+        void value_changed(unsigned int row, unsigned int column, T old_value, T new_value);
+        void region_changed(unsigned int top, unsigned int left, unsigned int height, unsigned int width);
+
+        unsigned long long get_version(void) const { return version.load(memory_order_acquire); }
+        unsigned int get_dirty_count(void) const;
+
+        unsigned long long get_delta(unsigned long long since, vector< grid_patch<T> > & patches) const;
+        unsigned long long take_delta(vector< grid_patch<T> > & patches);
+        static void apply_delta(gridgraph<T> & target, const vector< grid_patch<T> > & patches);
+
+    private:
+        gridgraph<T> & grid;
+        unsigned int tile_size;
+        unsigned int tile_rows;
+        unsigned int tile_columns;
+
+        atomic<unsigned long long> issued;  //last version handed to a write
+        atomic<unsigned long long> version; //last version whose write has finished marking
+        vector< atomic<unsigned long long> > tile_versions; //version of the last write to each tile
+        vector< atomic<unsigned long long> > dirty;         //one bit per tile, 64 tiles per word
+
+        void mark(unsigned int top, unsigned int left, unsigned int bottom, unsigned int right);
+        void add_patches(const vector<bool> & selected, vector< grid_patch<T> > & patches) const;
+};
+
+#endif
@@ -0,0 +1,384 @@
+//gridexport.cpp
+
+/* Buffered exporters for a gridgraph. See 'gridexport.h' for an overview. */
+
+#include "gridexport.h"
+#include <cstring>
+#include <thread>
+#include <functional>
+#include <algorithm>
+
+
+//"00" through "99", so integers are formatted two digits at a time
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+
+/* FUNCTION: Constructor for the buffer.
+ * ARGUMENTS: The stream to write to, or NULL to keep everything in memory, and how many bytes to
+ *            gather before each write.
+ * RETURN: Returns no values.
+ */
+output_buffer::output_buffer(ostream * to_write, size_t capacity)
+    : sink(to_write), buffer(capacity ? capacity : 1), used(0)
+{}
+
+
+/* FUNCTION: Destructor for the buffer. Writes out whatever is left.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+output_buffer::~output_buffer()
+{
+    flush();
+}
+
+
+/* FUNCTION: Appends one character.
+ * ARGUMENTS: The character.
+ * RETURN: Returns no values.
+ */
+void output_buffer::put(char to_put)
+{
+    if(used == buffer.size())
+        reserve(1);
+    buffer[used++] = to_put;
+}
+
+
+/* FUNCTION: Appends a C string.
+ * ARGUMENTS: The string.
+ * RETURN: Returns no values.
+ */
+void output_buffer::put(const char * to_put)
+{
+    put(to_put, strlen(to_put));
+}
+
+
+/* FUNCTION: Appends a run of bytes. Runs bigger than the buffer go straight to the sink.
+ * ARGUMENTS: The bytes and their count.
+ * RETURN: Returns no values.
+ */
+void output_buffer::put(const char * to_put, size_t length)
+{
+    if(sink && length > buffer.size()){
+        flush();
+        sink->write(to_put, length);
+        return;
+    }
+    if(used + length > buffer.size())
+        reserve(length);
+    memcpy(buffer.data() + used, to_put, length);
+    used += length;
+}
+
+
+/* FUNCTION: Appends a signed integer in decimal.
+ * ARGUMENTS: The integer.
+ * RETURN: Returns no values.
+ */
+void output_buffer::put_integer(long long to_put)
+{
+    if(to_put < 0){
+        put('-');
+        put_unsigned(0ULL - (unsigned long long) to_put);
+        return;
+    }
+    put_unsigned(to_put);
+}
+
+
+/* FUNCTION: Appends an unsigned integer in decimal, without going through a stream or printf.
+ * ARGUMENTS: The integer.
+ * RETURN: Returns no values.
+ */
+void output_buffer::put_unsigned(unsigned long long to_put)
+{
+    char digits[20];
+    char * start = digits + sizeof(digits);
+    while(to_put >= 100){
+        unsigned int pair = (to_put % 100) * 2;
+        to_put /= 100;
+        *--start = DIGIT_PAIRS[pair + 1];
+        *--start = DIGIT_PAIRS[pair];
+    }
+    if(to_put >= 10){
+        *--start = DIGIT_PAIRS[to_put * 2 + 1];
+        *--start = DIGIT_PAIRS[to_put * 2];
+    }
+    else
+        *--start = (char) ('0' + to_put);
+    put(start, digits + sizeof(digits) - start);
+}
+
+
+/* FUNCTION: Hands everything gathered so far to the sink. Does nothing for an in-memory buffer.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+void output_buffer::flush(void)
+{
+    if(!sink || used == 0)
+        return;
+    sink->write(buffer.data(), used);
+    used = 0;
+}
+
+
+/* FUNCTION: Makes room for more bytes: writes the buffer out, or grows it if there is no sink.
+ * ARGUMENTS: The number of bytes about to be added.
+ * RETURN: Returns no values.
+ */
+void output_buffer::reserve(size_t length)
+{
+    if(sink){
+        flush();
+        return;
+    }
+    buffer.resize(max(buffer.size() * 2, used + length));
+}
+
+
+
+
+/* FUNCTION: Constructor for the exporter.
+ * ARGUMENTS: The grid to export and the number of formatting threads (0 picks one per hardware thread).
+ * RETURN: Returns no values.
+ */
+template<class T>
+grid_exporter<T>::grid_exporter(const gridgraph<T> & to_export, unsigned int count)
+    : grid(to_export), threads(count ? count : max(1u, thread::hardware_concurrency())), color(NULL),
+      rows(to_export.get_column_size()), columns(to_export.get_row_size())
+{}
+
+
+/* FUNCTION: Writes the cell values.
+ * ARGUMENTS: The stream to write to, and EXPORT_TEXT, EXPORT_CSV, EXPORT_PGM or EXPORT_PPM.
+ * RETURN: False for any other format or if the stream failed.
+ */
+template<class T>
+bool grid_exporter<T>::write_values(ostream & out, export_format format) const
+{
+    if(format == EXPORT_EDGES)
+        return false;
+    return write_bands(out, format, false);
+}
+
+
+/* FUNCTION: Writes the adjacency of every vertex.
+ * ARGUMENTS: The stream to write to, and EXPORT_TEXT, EXPORT_CSV or EXPORT_EDGES.
+ * RETURN: False for any other format or if the stream failed.
+ */
+template<class T>
+bool grid_exporter<T>::write_adjacency(ostream & out, export_format format) const
+{
+    if(format == EXPORT_PGM || format == EXPORT_PPM)
+        return false;
+    return write_bands(out, format, true);
+}
+
+
+/* FUNCTION: Writes the header, every band of rows and the trailer. One thread streams the bands
+ *           through a single buffer. With several, the workers are started once and format bands
+ *           into their double buffers while this thread writes the finished ones out in order.
+ * ARGUMENTS: The stream, the format, and whether to write the adjacency rather than the values.
+ * RETURN: True if the stream is still good.
+ */
+template<class T>
+bool grid_exporter<T>::write_bands(ostream & out, export_format format, bool adjacency) const
+{
+    output_buffer direct(&out);
+    if(!adjacency && (format == EXPORT_PGM || format == EXPORT_PPM)){
+        direct.put(format == EXPORT_PGM ? "P5\n" : "P6\n");
+        direct.put_unsigned(columns);
+        direct.put(' ');
+        direct.put_unsigned(rows);
+        direct.put("\n255\n");
+    }
+    if(adjacency && format == EXPORT_CSV)
+        direct.put("source,target\n");
+
+    unsigned int band_rows = max(1u, EXPORT_BAND_CELLS / max(1u, columns));
+    unsigned int bands = (rows + band_rows - 1) / band_rows;
+    unsigned int workers = min(threads, bands);
+
+    if(workers <= 1){
+        for(unsigned int band = 0; band < bands; ++band)
+            format_band(direct, format, adjacency, band * band_rows, min(rows, (band + 1) * band_rows));
+    }
+    else
+    {
+        direct.flush();
+        band_pipeline shared;
+        shared.slots.resize(2 * workers);
+        shared.format = format;
+        shared.adjacency = adjacency;
+        shared.band_rows = band_rows;
+        shared.bands = bands;
+        shared.workers = workers;
+
+        vector<thread> pool;
+        for(unsigned int w = 0; w < workers; ++w)
+            pool.push_back(thread(&grid_exporter<T>::format_worker, this, ref(shared), w));
+
+        for(unsigned int band = 0; band < bands; ++band)
+        {
+            band_slot & slot = shared.slots[2 * (band % workers) + (band / workers) % 2];
+            {
+                unique_lock<mutex> hold(shared.lock);
+                shared.changed.wait(hold, [&slot]{ return slot.full; });
+            }
+            out.write(slot.piece.data(), slot.piece.size());
+            {
+                lock_guard<mutex> hold(shared.lock);
+                slot.full = false;
+            }
+            shared.changed.notify_all();
+        }
+
+        for(unsigned int w = 0; w < workers; ++w)
+            pool[w].join();
+    }
+
+    if(adjacency && format == EXPORT_TEXT)
+        direct.put('\n');
+    direct.flush();
+    return out.good();
+}
+
+
+/* FUNCTION: Body of a formatting thread: formats every workers-th band, starting at its own index,
+ *           alternating between its two buffers. It waits for a buffer to be written out before
+ *           filling it again, so it runs at most one band ahead of the writer.
+ * ARGUMENTS: The state shared with the writing thread, and the worker's index.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void grid_exporter<T>::format_worker(band_pipeline & shared, unsigned int worker) const
+{
+    for(unsigned int band = worker; band < shared.bands; band += shared.workers)
+    {
+        band_slot & slot = shared.slots[2 * worker + (band / shared.workers) % 2];
+        {
+            unique_lock<mutex> hold(shared.lock);
+            shared.changed.wait(hold, [&slot]{ return !slot.full; });
+        }
+        slot.piece.clear();
+        unsigned int first = band * shared.band_rows;
+        format_band(slot.piece, shared.format, shared.adjacency, first, min(rows, first + shared.band_rows));
+        {
+            lock_guard<mutex> hold(shared.lock);
+            slot.full = true;
+        }
+        shared.changed.notify_all();
+    }
+}
+
+
+/* FUNCTION: Formats one band of rows.
+ * ARGUMENTS: The buffer to fill, the format, whether to format the adjacency, and the first and
+ *            one-past-last row.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void grid_exporter<T>::format_band(output_buffer & to_fill, export_format format, bool adjacency, unsigned int first, unsigned int last) const
+{
+    if(adjacency)
+        format_adjacency(to_fill, format, first, last);
+    else
+        format_values(to_fill, format, first, last);
+}
+
+
+/* FUNCTION: Formats the values of a band of rows, read from the grid in one region read.
+ * ARGUMENTS: The buffer to fill, the format, and the first and one-past-last row.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void grid_exporter<T>::format_values(output_buffer & to_fill, export_format format, unsigned int first, unsigned int last) const
+{
+    vector<T> values((size_t) (last - first) * columns);
+    grid.get_region_values(values.data(), first, 0, last - first, columns);
+
+    char separator = format == EXPORT_CSV ? ',' : ' ';
+    const T * value = values.data();
+    for(unsigned int row = first; row < last; ++row)
+    {
+        for(unsigned int column = 0; column < columns; ++column, ++value)
+        {
+            if(format == EXPORT_PGM){
+                to_fill.put((char) (unsigned char) *value);
+                continue;
+            }
+            if(format == EXPORT_PPM){
+                unsigned char rgb[3];
+                if(color)
+                    color(*value, rgb);
+                else
+                    rgb[0] = rgb[1] = rgb[2] = (unsigned char) *value;
+                to_fill.put((const char *) rgb, 3);
+                continue;
+            }
+            if(column)
+                to_fill.put(separator);
+            to_fill.put_integer((long long) *value);
+        }
+        if(format == EXPORT_TEXT || format == EXPORT_CSV)
+            to_fill.put('\n');
+    }
+}
+
+
+/* FUNCTION: Formats the adjacency of every vertex in a band of rows. Text matches display_vertices:
+ *           position, type, coordinates and the neighbours in the same order, then a blank line.
+ * ARGUMENTS: The buffer to fill, the format, and the first and one-past-last row.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void grid_exporter<T>::format_adjacency(output_buffer & to_fill, export_format format, unsigned int first, unsigned int last) const
+{
+    char separator = format == EXPORT_CSV ? ',' : ' ';
+    for(unsigned int row = first; row < last; ++row)
+        for(unsigned int column = 0; column < columns; ++column)
+        {
+            unsigned int adjacent[4];
+            const char * type;
+            unsigned int count = grid.get_adjacent_positions(row, column, adjacent, type);
+            unsigned int position = row * columns + column;
+
+            if(format != EXPORT_TEXT){
+                for(unsigned int k = 0; k < count; ++k){
+                    to_fill.put_unsigned(position);
+                    to_fill.put(separator);
+                    to_fill.put_unsigned(adjacent[k]);
+                    to_fill.put('\n');
+                }
+                continue;
+            }
+
+            to_fill.put_unsigned(position);
+            to_fill.put('\t');
+            to_fill.put(type);
+            to_fill.put("\t(");
+            to_fill.put_unsigned(row);
+            to_fill.put(", ");
+            to_fill.put_unsigned(column);
+            to_fill.put(") -> (");
+            for(unsigned int k = 0; k < count; ++k){
+                if(k)
+                    to_fill.put(", ");
+                to_fill.put('(');
+                to_fill.put_unsigned(adjacent[k] / columns);
+                to_fill.put(", ");
+                to_fill.put_unsigned(adjacent[k] % columns);
+                to_fill.put(')');
+            }
+            to_fill.put(")\n\n");
+        }
+}
+
+
+template class grid_exporter<char>;
@@ -0,0 +1,105 @@
+//gridexport.h
+
+/* Buffered exporters for a gridgraph. display_vertices and display_as_grid are fine for looking at a
+ * small grid; these are for dumping large ones to a file or any other ostream.
+ *
+ *   write_values    - the cell values as text (space separated), CSV, or a binary PGM / PPM image
+ *                     (one byte per cell, or three with a colour function).
+ *   write_adjacency - the adjacency listing as text (the same listing display_vertices prints), CSV
+ *                     or an edge list of array positions, one directed edge per line.
+ *
+ * Output is formatted into large buffers with a hand-rolled integer formatter and handed to the sink
+ * in big writes, never flushed line by line. With more than one thread, the grid is cut into bands of
+ * rows and a fixed set of workers, started once per write, takes every n-th band. Each worker fills
+ * two buffers in turn, so it formats its next band while the caller writes its last one to the sink.
+ * The caller writes the bands in order, so the output is the same whatever the thread count. */
+
+#ifndef GRIDEXPORT_H
+#define GRIDEXPORT_H
+
+#include "gridgraph.h"
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+
+const size_t EXPORT_BUFFER_SIZE = 1 << 20;  //bytes gathered before each write to the sink
+const unsigned int EXPORT_BAND_CELLS = 1 << 16; //cells per band of rows handed to a thread
+
+enum export_format { EXPORT_TEXT, EXPORT_CSV, EXPORT_PGM, EXPORT_PPM, EXPORT_EDGES };
+
+
+class output_buffer
+{
+    public:
+        output_buffer(ostream * sink, size_t capacity = EXPORT_BUFFER_SIZE); //NULL sink: grow and keep everything
+        ~output_buffer();
+
+        void put(char to_put);
+        void put(const char * to_put);
+        void put(const char * to_put, size_t length);
+        void put_integer(long long to_put);
+        void put_unsigned(unsigned long long to_put);
+
+        void flush(void);
+        void clear(void) { used = 0; }
+        bool good(void) const { return !sink || sink->good(); }
+        const char * data(void) const { return buffer.data(); }
+        size_t size(void) const { return used; }
+
+    private:
+        ostream * sink;
+        vector<char> buffer;
+        size_t used;
+
+        void reserve(size_t length);
+};
+
+
+template<class T>
+class grid_exporter
+{
+    public:
+        typedef void (*cell_color)(T value, unsigned char * rgb); //fills rgb[0..2] for EXPORT_PPM
+
+        grid_exporter(const gridgraph<T> & grid, unsigned int threads = 0);
+
+        void set_color(cell_color to_set) { color = to_set; }
+
+        bool write_values(ostream & out, export_format format) const;
+        bool write_adjacency(ostream & out, export_format format) const;
+
+    private:
+        struct band_slot //one of a worker's two buffers
+        {
+            output_buffer piece;
+            bool full; //formatted and not yet written
+            band_slot() : piece(NULL), full(false) {}
+        };
+
+        struct band_pipeline //shared by the caller and the workers of one write
+        {
+            mutex lock;
+            condition_variable changed;
+            vector<band_slot> slots; //band b goes to slot 2 * (b % workers) + (b / workers) % 2
+            export_format format;
+            bool adjacency;
+            unsigned int band_rows;
+            unsigned int bands;
+            unsigned int workers;
+        };
+
+        const gridgraph<T> & grid;
+        unsigned int threads;
+        cell_color color; //NULL paints each cell grey with its own value
+        unsigned int rows;
+        unsigned int columns;
+
+        bool write_bands(ostream & out, export_format format, bool adjacency) const;
+        void format_worker(band_pipeline & shared, unsigned int worker) const;
+        void format_band(output_buffer & to_fill, export_format format, bool adjacency, unsigned int first, unsigned int last) const;
+        void format_values(output_buffer & to_fill, export_format format, unsigned int first, unsigned int last) const;
+        void format_adjacency(output_buffer & to_fill, export_format format, unsigned int first, unsigned int last) const;
+};
+
+#endif
@@ -10,6 +10,38 @@
 
 
 #include "gridgraph.h"
+#include <new>
+#include <algorithm>
+#include <type_traits>
+#include <memory>
+#include <stdexcept>
+
+
+/* Relaxed single-copy loads and stores of a cell value. Used wherever other threads may be touching
+ * the same cell in concurrent mode; correctness comes from the tile sequence numbers around them. */
+template<class T>
+static inline T load_cell(const T * from)
+{
+    T value;
+    __atomic_load(from, &value, __ATOMIC_RELAXED);
+    return value;
+}
+
+template<class T>
+static inline void store_cell(T * to, T value)
+{
+    __atomic_store(to, &value, __ATOMIC_RELAXED);
+}
+
+
+/* Every vertex type gets a slot of the same size in the vertex slab. */
+template<class T>
+struct vertex_slot
+{
+    static const size_t alignment = max(alignof(center<T>), max(alignof(side<T>), alignof(corner<T>)));
+    static const size_t size = (max(sizeof(center<T>), max(sizeof(side<T>), sizeof(corner<T>))) + alignment - 1) / alignment * alignment;
+};
+
 
 /* FUNCTION: Default constructor for the graph when no arguments are given.
  * ARGUMENTS: Uses global constants as parameters (Set in 'gridgraph.h') 
@@ -19,6 +51,7 @@
 template<class T>
 gridgraph<T>::gridgraph(int rows_in_grid, int columns_in_grid) : row_size(columns_in_grid), column_size(rows_in_grid)
 {
+    use_storage(STORAGE_HEAP, NULL);
     graph_init();
 }
 
@@ -30,6 +63,34 @@ gridgraph<T>::gridgraph(int rows_in_grid, int columns_in_grid) : row_size(column
 template<class T>
 gridgraph<T>::gridgraph(const unsigned int & rows_in_grid, const unsigned int & columns_in_grid) : row_size(columns_in_grid), column_size(rows_in_grid)
 {
+    use_storage(STORAGE_HEAP, NULL);
+    graph_init();
+}
+
+
+/* FUNCTION: Constructor for a graph that owns the memory its vertices live in, or for a lazy graph.
+ * ARGUMENTS: the number of rows and the number of columns, the storage mode (heap, arena, arena backed
+ *            by huge pages, or lazy), and the value unwritten cells read back in lazy mode.
+ * RETURN: Returns no values.
+ */
+template<class T>
+gridgraph<T>::gridgraph(unsigned int rows_in_grid, unsigned int columns_in_grid, storage_mode storage, T default_value) : row_size(columns_in_grid), column_size(rows_in_grid)
+{
+    use_storage(storage, NULL);
+    lazy_default = default_value;
+    graph_init();
+}
+
+
+/* FUNCTION: Constructor for a graph whose storage comes from a caller-supplied memory resource. The
+ *           resource must outlive the graph.
+ * ARGUMENTS: the number of rows and the number of columns, and the memory resource.
+ * RETURN: Returns no values.
+ */
+template<class T>
+gridgraph<T>::gridgraph(unsigned int rows_in_grid, unsigned int columns_in_grid, std::pmr::memory_resource * memory) : row_size(columns_in_grid), column_size(rows_in_grid)
+{
+    use_storage(STORAGE_HEAP, memory);
     graph_init();
 }
 
@@ -41,22 +102,29 @@ gridgraph<T>::gridgraph(const unsigned int & rows_in_grid, const unsigned int &
 template<class T>
 gridgraph<T>::gridgraph(const gridgraph<T> & to_copy) : row_size(to_copy.row_size), column_size(to_copy.column_size)
 {
-   //initialize the new graph	
+   //initialize the new graph with the same kind of storage
+   use_storage(to_copy.mode, to_copy.owned_arena ? NULL : to_copy.resource);
+   lazy_default = to_copy.lazy_default;
    graph_init();
+   if(to_copy.tile_locks)
+       enable_concurrency(to_copy.tile_size);
 
-   //copy the values
-   vertex<T> * dest = *gridArray;
-   vertex<T> * source = *to_copy.gridArray;
-   vertex<T> * end = *END;
-   while(dest < end)
+   //a lazy copy only copies the tiles that were written
+   if(lazy_tiles)
    {
-	   dest->set_value(source->get_value());
-	   ++dest;
-	   ++source;
+       for(unsigned int index = 0; index < lazy_tile_count; ++index){
+           const T * tile = to_copy.lazy_tiles[index].load(memory_order_acquire);
+           if(tile)
+               copy(tile, tile + LAZY_TILE_SIZE * LAZY_TILE_SIZE, lazy_tile(index));
+       }
+       return;
    }
 
-
-
+   //copy the values
+   T * values = new T[array_length];
+   to_copy.get_all_values(values);
+   set_all_values(values);
+   delete [] values;
 }
 
 /* FUNCTION: Constructor for abstract base vertex.
@@ -101,6 +169,42 @@ center<T>::center(const unsigned int & array_position, const unsigned int & row_
 
 
 
+/* FUNCTION: Chooses where the graph's storage comes from. Called by every constructor before graph_init.
+ *           Rejects grids whose cell count does not fit in an unsigned int position, before anything is
+ *           allocated.
+ * ARGUMENTS: The storage mode, and a caller-supplied memory resource (NULL for the default one).
+ * RETURN: Returns no values. Throws length_error if rows * columns exceeds MAX_CELLS.
+ */
+template<class T>
+void gridgraph<T>::use_storage(storage_mode storage, std::pmr::memory_resource * memory)
+{
+    if((unsigned long long) row_size * column_size > MAX_CELLS)
+        throw length_error("gridgraph: rows * columns does not fit in a position");
+
+    mode = storage;
+    owned_arena = NULL;
+    lazy_default = T();
+    resource = memory ? memory : std::pmr::get_default_resource();
+    if(!memory && (storage == STORAGE_ARENA || storage == STORAGE_HUGE_PAGES)){
+        owned_arena = new grid_arena(storage_bytes(column_size, row_size), storage == STORAGE_HUGE_PAGES);
+        resource = owned_arena;
+    }
+}
+
+
+/* FUNCTION: Computes how many bytes a graph of the given size allocates at construction, so an arena
+ *           can be sized to hold it in one block.
+ * ARGUMENTS: the number of rows and the number of columns.
+ * RETURN: The number of bytes.
+ */
+template<class T>
+size_t gridgraph<T>::storage_bytes(unsigned int rows_in_grid, unsigned int columns_in_grid)
+{
+    size_t cells = (size_t) rows_in_grid * columns_in_grid;
+    return cells * sizeof(vertex<T> *) + cells * vertex_slot<T>::size + vertex_slot<T>::alignment;
+}
+
+
 /* FUNCTION: Function initializes the graph by iterating through the vertices and deducing each vertex's type.
  * ARGUMENTS: None. Class members that are stored in the constructor act as parameters to this function. 
  * RETURN: Returns no values. 
@@ -109,7 +213,26 @@ template<class T>
 void gridgraph<T>::graph_init()
 {
     array_length = row_size * column_size;
-    gridArray = new vertex<T>*[array_length];
+    tile_locks = NULL;
+    tile_size = tile_columns = tile_count = 0;
+    lazy_tiles = NULL;
+
+    //lazy graphs build nothing up front; tiles appear as cells are written
+    if(mode == STORAGE_LAZY)
+    {
+        gridArray = END = NULL;
+        vertex_storage = NULL;
+        lazy_tile_columns = (row_size + LAZY_TILE_SIZE - 1) / LAZY_TILE_SIZE;
+        lazy_tile_count = lazy_tile_columns * ((column_size + LAZY_TILE_SIZE - 1) / LAZY_TILE_SIZE);
+        lazy_tiles = new atomic<T *>[lazy_tile_count];
+        for(unsigned int index = 0; index < lazy_tile_count; ++index)
+            lazy_tiles[index].store(NULL, memory_order_relaxed);
+        lazy_written.store(0, memory_order_relaxed);
+        return;
+    }
+
+    gridArray = (vertex<T> **) resource->allocate(array_length * sizeof(vertex<T> *), alignof(vertex<T> *));
+    vertex_storage = (char *) resource->allocate(array_length * vertex_slot<T>::size, vertex_slot<T>::alignment);
     END = (gridArray + array_length);
 
     vertex<T> ** current = gridArray;
@@ -146,14 +269,16 @@ vertex<T> * gridgraph<T>::determine_vertex_type(const unsigned int & position, c
     if(column_position == 0 || column_position == row_size - 1)
         --adjacencies;
 
+    void * slot = vertex_storage + position * vertex_slot<T>::size;
+
     if(adjacencies == 3)
-        return new side<T>(position, row_position, column_position);
+        return new (slot) side<T>(position, row_position, column_position);
 
     if(adjacencies == 4)
-        return new center<T>(position, row_position, column_position);
+        return new (slot) center<T>(position, row_position, column_position);
 
     if(adjacencies == 2)
-        return new corner<T>(position, row_position, column_position);
+        return new (slot) corner<T>(position, row_position, column_position);
 
 
     return NULL;
@@ -312,14 +437,23 @@ gridgraph<T>::~gridgraph()
     vertex<T> ** temp = gridArray;
     if(gridArray)
     {
-        while(temp < END)
-        {
-            delete *temp;
-            ++temp;
-        }
-        delete [] gridArray;
+        //vertices hold nothing but their value, so they only need destroying if the value does
+        if(!is_trivially_destructible<T>::value)
+            while(temp < END)
+            {
+                (*temp)->~vertex<T>();
+                ++temp;
+            }
+        resource->deallocate(vertex_storage, array_length * vertex_slot<T>::size, vertex_slot<T>::alignment);
+        resource->deallocate(gridArray, array_length * sizeof(vertex<T> *), alignof(vertex<T> *));
         gridArray = NULL;
     }
+    if(tile_locks)
+        resource->deallocate(tile_locks, tile_count * sizeof(tile_lock), alignof(tile_lock));
+    tile_locks = NULL;
+    release_lazy_tiles();
+    delete owned_arena;
+    owned_arena = NULL;
     row_size = 0;
     column_size = 0;
     array_length = 0;
@@ -366,25 +500,29 @@ vertex<T>::~vertex()
 
 
 /* FUNCTION: Function to display the entire graph as a simple grid.
- * ARGUMENTS: No params.
+ * ARGUMENTS: The stream to write to (standard output by default).
  * RETURN: Returns no values.  
  */
 template<class T>
-void gridgraph<T>::display_as_grid(void) const
+void gridgraph<T>::display_as_grid(ostream & out) const
 {
-    cout << endl;
+    out << '\n';
     vertex<T> ** temp = gridArray;
     for(unsigned int i = 0; i < column_size; ++i)
     {
         for(unsigned int j = 0; j < row_size; ++j)
         {
+	    if(!temp){ //lazy graphs have no vertices to ask
+	        out << '(' << i << ", " << j << ')' << '\t';
+	        continue;
+	    }
 	
-	    cout << '(' << (*temp)->get_row_pos() << ", " << (*temp)->get_column_pos()	<< ')' << '\t';
+	    out << '(' << (*temp)->get_row_pos() << ", " << (*temp)->get_column_pos()	<< ')' << '\t';
             ++temp;
         }
-        cout << endl << endl;
+        out << "\n\n";
     }
-    cout << endl;
+    out << '\n';
     return;
 }
 
@@ -392,67 +530,84 @@ void gridgraph<T>::display_as_grid(void) const
 
 
 /* FUNCTION: Displays the grid in graph-notation form.
- * ARGUMENTS: No params.
+ * ARGUMENTS: The stream to write to (standard output by default).
  * RETURN: Returns no values.
  */
 template<class T>
-void gridgraph<T>::display_vertices(void) const
+void gridgraph<T>::display_vertices(ostream & out) const
 {
+    //a lazy graph has no vertices, so its listing is worked out from the coordinates
+    if(lazy_tiles){
+        for(unsigned int row = 0; row < column_size; ++row)
+            for(unsigned int column = 0; column < row_size; ++column)
+            {
+                unsigned int adjacent[4];
+                const char * type;
+                unsigned int count = get_adjacent_positions(row, column, adjacent, type);
+                out << row * row_size + column << '\t' << type << "\t(" << row << ", " << column << ") -> (";
+                for(unsigned int k = 0; k < count; ++k)
+                    out << (k ? ", (" : "(") << adjacent[k] / row_size << ", " << adjacent[k] % row_size << ')';
+                out << ")\n\n";
+            }
+        out << '\n';
+        return;
+    }
+
     vertex<T> ** start = gridArray;
     while(start < END)
     {
         for(unsigned int i = 0; i < row_size; ++i, ++start){
-            (*start)->display();
-            cout << endl;
+            (*start)->display(out);
+            out << '\n';
         }
     }
-    cout << endl;
+    out << '\n';
 }
 
 
 
 
 /* FUNCTION: Displays the array, row, and column position, adjacencies, and type, of a corner.
- * ARGUMENTS: No params.
+ * ARGUMENTS: The stream to write to (standard output by default).
  * RETURN: Returns no values.
  */
 template<class T>
-void corner<T>::display()
+void corner<T>::display(ostream & out)
 {
-	cout << vertex<T>::position << '\t'
+	out << vertex<T>::position << '\t'
 	     << "corner\t" << '(' << vertex<T>::row_pos << ", " << vertex<T>::column_pos << ')' << " -> " 
 	     << "((" << vertical_adj->get_row_pos()   << ", " << vertical_adj->get_column_pos()   << ')'  << ", " 
-	     << '('  << horizontal_adj->get_row_pos() << ", " << horizontal_adj->get_column_pos() << "))" << endl;
+	     << '('  << horizontal_adj->get_row_pos() << ", " << horizontal_adj->get_column_pos() << "))\n";
 }
 
 
 /* FUNCTION: Displays the array, row, and column position, adjacencies, and type, of a side.
- * ARGUMENTS: No params.
+ * ARGUMENTS: The stream to write to (standard output by default).
  * RETURN: Returns no values.
  */
 template<class T>
-void side<T>::display()
+void side<T>::display(ostream & out)
 {
-	cout << vertex<T>::position << '\t'
+	out << vertex<T>::position << '\t'
 	     << "side\t" << '(' << vertex<T>::row_pos << ", " << vertex<T>::column_pos << ')' << " -> " 
 	     << "((" << pi_radian1st->get_row_pos() << ", " << pi_radian1st->get_column_pos() << ')'  << ", " 
 	     << '('  << pi_radian2nd->get_row_pos() << ", " << pi_radian2nd->get_column_pos() << ')'  << ", " 
-	     << '('  << pi_radian3rd->get_row_pos() << ", " << pi_radian3rd->get_column_pos() << "))" << endl;
+	     << '('  << pi_radian3rd->get_row_pos() << ", " << pi_radian3rd->get_column_pos() << "))\n";
 }
 
 /* FUNCTION: Displays the array, row, and column position, adjacencies, and type, of a center.
- * ARGUMENTS: No params.
+ * ARGUMENTS: The stream to write to (standard output by default).
  * RETURN: Returns no values.
  */
 template<class T>
-void center<T>::display()
+void center<T>::display(ostream & out)
 {
-    cout << vertex<T>::position << '\t'
+    out << vertex<T>::position << '\t'
 	 << "center\t" << '(' << vertex<T>::row_pos << ", " << vertex<T>::column_pos << ')' <<  " -> " 
 	 << "((" << right->get_row_pos() << ", " << right->get_column_pos() << ')' << ", " 
 	 << '('  << up->get_row_pos()    << ", " << up->get_column_pos()    << ')' << ", "
 	 << '('  << left->get_row_pos()  << ", " << left->get_column_pos()  << ')' << ", "
-	 << '('  << down->get_row_pos()  << ", " << down->get_column_pos()  << "))" << endl;
+	 << '('  << down->get_row_pos()  << ", " << down->get_column_pos()  << "))\n";
 }
 
 
@@ -512,7 +667,7 @@ void center<T>::expand()
 template<class T>
 bool gridgraph<T>::valid_coordinate(unsigned int row, unsigned int column) const
 {
-	return !(row < 0 || column < 0 || row > row_size || column > column_size);
+	return row < column_size && column < row_size;
 }
 
 
@@ -524,6 +679,14 @@ bool gridgraph<T>::valid_coordinate(unsigned int row, unsigned int column) const
 template<class T>
 bool gridgraph<T>::get_coordinate_by_position(unsigned int position, unsigned int & row, unsigned int & column) const
 {
+	if(lazy_tiles){
+		if(position >= array_length)
+			return false;
+		row = position / row_size;
+		column = position % row_size;
+		return true;
+	}
+
 	vertex<T> ** target = (gridArray + position);
 	if(position < 0 || target > END)
 		return false;
@@ -544,6 +707,10 @@ bool gridgraph<T>::get_position_by_coordinate(unsigned int & position, unsigned
 	if(!valid_coordinate(row, column))
 		return false;
 
+	if(lazy_tiles){
+		position = row * row_size + column;
+		return true;
+	}
 	position = (*(gridArray + (row * row_size) + column))->get_position();
 	return true;
 }
@@ -558,7 +725,25 @@ T gridgraph<T>::get_value_at_cord(unsigned int row, unsigned int column) const
 {
 	if(!valid_coordinate(row, column))
 		return (T) NULL;
-	return (*(gridArray + (row * row_size) + column))->get_value();  
+	const T * cell = lazy_tiles ? find_lazy_cell(row, column) : (*(gridArray + (row * row_size) + column))->get_value_address();
+	if(!cell)
+		return lazy_default; //a lazy tile that was never written
+	if(!tile_locks)
+		return *cell;
+
+	//a single word is always read whole; anything larger is read under its tile's seqlock
+	if(__atomic_always_lock_free(sizeof(T), 0))
+		return load_cell(cell);
+
+	const atomic<unsigned int> & sequence = tile_locks[tile_of(row, column)].sequence;
+	for(;;)
+	{
+		unsigned int before = read_tile_begin(tile_of(row, column));
+		T value = load_cell(cell);
+		atomic_thread_fence(memory_order_acquire);
+		if(sequence.load(memory_order_relaxed) == before)
+			return value;
+	}
 }
 
 
@@ -572,8 +757,42 @@ void gridgraph<T>::set_value_at_cord(T to_set, unsigned int row, unsigned int co
 {
 	if(!valid_coordinate(row, column))
 		return;
-	(*(gridArray + (row * row_size) + column))->set_value(to_set);
-	return;
+
+	T old_value = store_value(to_set, row, column);
+	for(unsigned int i = 0; i < observers.size(); ++i)
+		observers[i]->value_changed(row, column, old_value, to_set);
+}
+
+
+/* FUNCTION: Does the actual write of one cell for set_value_at_cord, in whatever mode the graph is in.
+ *           In concurrent mode the tile is held around the store, and the old value is read under it
+ *           (by an atomic exchange for a word), so no other write can slip in between.
+ * ARGUMENTS: The value to be set and the (valid) row and column coordinates.
+ * RETURN: The value the cell held before.
+ */
+template<class T>
+T gridgraph<T>::store_value(T to_set, unsigned int row, unsigned int column)
+{
+	//writing the default into an untouched lazy tile changes nothing, so it allocates nothing
+	if(lazy_tiles && to_set == lazy_default && !find_lazy_cell(row, column))
+		return lazy_default;
+	T * cell = cell_address(row, column);
+	if(!tile_locks){
+		T old_value = *cell;
+		*cell = to_set;
+		return old_value;
+	}
+
+	T old_value;
+	lock_cell(row, column);
+	if(__atomic_always_lock_free(sizeof(T), 0))
+		old_value = __atomic_exchange_n(cell, to_set, __ATOMIC_ACQ_REL); //single-cell readers of a word skip the lock
+	else {
+		old_value = load_cell(cell);
+		store_cell(cell, to_set);
+	}
+	unlock_cell(row, column);
+	return old_value;
 }
 
 
@@ -585,6 +804,11 @@ void gridgraph<T>::set_value_at_cord(T to_set, unsigned int row, unsigned int co
 template<class T>
 void gridgraph<T>::get_all_values(T * to_get) const
 {
+	if(tile_locks || lazy_tiles){
+		get_region_values(to_get, 0, 0, column_size, row_size);
+		return;
+	}
+
 	T * temp = to_get;
 	vertex<T> ** current = gridArray;
 	while(current < END)
@@ -604,6 +828,11 @@ void gridgraph<T>::get_all_values(T * to_get) const
 template<class T>
 void gridgraph<T>::set_all_values(T * to_set)
 {
+	if(tile_locks || lazy_tiles || !observers.empty()){
+		set_region_values(to_set, 0, 0, column_size, row_size);
+		return;
+	}
+
 	T * temp = to_set;
 	vertex<T> ** current = gridArray;
 	while(current < END)
@@ -616,6 +845,568 @@ void gridgraph<T>::set_all_values(T * to_set)
 
 
 
+/* FUNCTION: Copies a rectangle of values out of the grid, row by row. In concurrent mode the copy is a
+ *           consistent snapshot: it is retried until no tile it touched changed while it was read, and
+ *           after SNAPSHOT_RETRIES failed tries it locks those tiles instead, so a steady stream of
+ *           writes cannot keep it from finishing.
+ * ARGUMENTS: The buffer to fill (height * width values), and the top-left corner and size of the rectangle.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void gridgraph<T>::get_region_values(T * to_get, unsigned int top, unsigned int left, unsigned int height, unsigned int width) const
+{
+	if(height == 0 || width == 0 || top + height > column_size || left + width > row_size)
+		return;
+
+	if(!tile_locks)
+	{
+		read_region(to_get, top, left, height, width);
+		return;
+	}
+
+	unsigned int first_tile_row = top / tile_size, last_tile_row = (top + height - 1) / tile_size;
+	unsigned int first_tile_column = left / tile_size, last_tile_column = (left + width - 1) / tile_size;
+	unsigned int touched_columns = last_tile_column - first_tile_column + 1;
+	unsigned int touched = (last_tile_row - first_tile_row + 1) * touched_columns;
+	unsigned int * before = new unsigned int[touched];
+
+	bool consistent = false;
+	for(unsigned int attempt = 0; attempt < SNAPSHOT_RETRIES && !consistent; ++attempt)
+	{
+		for(unsigned int i = 0; i < touched; ++i)
+			before[i] = read_tile_begin((first_tile_row + i / touched_columns) * tile_columns + first_tile_column + i % touched_columns);
+
+		read_region(to_get, top, left, height, width);
+
+		atomic_thread_fence(memory_order_acquire);
+		consistent = true;
+		for(unsigned int i = 0; i < touched && consistent; ++i)
+			consistent = tile_locks[(first_tile_row + i / touched_columns) * tile_columns + first_tile_column + i % touched_columns]
+			                 .sequence.load(memory_order_relaxed) == before[i];
+	}
+	delete [] before;
+
+	//writers kept moving the tiles: hold them all while copying, as a region write does
+	if(!consistent){
+		lock_region(top, left, height, width);
+		read_region(to_get, top, left, height, width);
+		unlock_region(top, left, height, width);
+	}
+}
+
+
+/* FUNCTION: Writes a rectangle of values into the grid, row by row. In concurrent mode every tile the
+ *           rectangle touches is locked (in increasing tile order) for the whole write, so readers see
+ *           either none or all of it.
+ * ARGUMENTS: The values (height * width of them), and the top-left corner and size of the rectangle.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void gridgraph<T>::set_region_values(const T * to_set, unsigned int top, unsigned int left, unsigned int height, unsigned int width)
+{
+	if(height == 0 || width == 0 || top + height > column_size || left + width > row_size)
+		return;
+
+	store_region(to_set, top, left, height, width);
+	for(unsigned int i = 0; i < observers.size(); ++i)
+		observers[i]->region_changed(top, left, height, width);
+}
+
+
+/* FUNCTION: Does the actual write of a rectangle for set_region_values, in whatever mode the graph is in.
+ * ARGUMENTS: The values (height * width of them), and the top-left corner and size of a valid rectangle.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void gridgraph<T>::store_region(const T * to_set, unsigned int top, unsigned int left, unsigned int height, unsigned int width)
+{
+	if(tile_locks)
+		lock_region(top, left, height, width);
+	write_region(to_set, top, left, height, width);
+	if(tile_locks)
+		unlock_region(top, left, height, width);
+}
+
+
+/* FUNCTION: Takes every tile a rectangle touches, in increasing tile order so that two threads
+ *           locking overlapping rectangles cannot deadlock.
+ * ARGUMENTS: The top-left corner and size of a valid rectangle.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void gridgraph<T>::lock_region(unsigned int top, unsigned int left, unsigned int height, unsigned int width) const
+{
+	for(unsigned int tile_row = top / tile_size; tile_row <= (top + height - 1) / tile_size; ++tile_row)
+		for(unsigned int tile_column = left / tile_size; tile_column <= (left + width - 1) / tile_size; ++tile_column)
+			lock_tile(tile_row * tile_columns + tile_column);
+}
+
+
+/* FUNCTION: Releases the tiles taken by lock_region.
+ * ARGUMENTS: The top-left corner and size of the same rectangle.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void gridgraph<T>::unlock_region(unsigned int top, unsigned int left, unsigned int height, unsigned int width) const
+{
+	for(unsigned int tile_row = top / tile_size; tile_row <= (top + height - 1) / tile_size; ++tile_row)
+		for(unsigned int tile_column = left / tile_size; tile_column <= (left + width - 1) / tile_size; ++tile_column)
+			unlock_tile(tile_row * tile_columns + tile_column);
+}
+
+
+/* FUNCTION: Works out a vertex's type and neighbours from its coordinates alone, in the order the
+ *           corner, side and center classes store them, so a lazy graph lists the same neighbours.
+ * ARGUMENTS: The vertex's row and column, an array of four positions to fill, and the type to set.
+ * RETURN: The number of neighbours.
+ */
+template<class T>
+unsigned int gridgraph<T>::get_adjacent_positions(unsigned int row, unsigned int column, unsigned int * adjacent, const char * & type) const
+{
+	unsigned int position = row * row_size + column;
+	bool top = row == 0, bottom = row == column_size - 1, left = column == 0, right = column == row_size - 1;
+
+	if(column_size < 2 || row_size < 2) //a single row or column: whichever of right, up, left, down exist
+	{
+		unsigned int count = 0;
+		if(!right) adjacent[count++] = position + 1;
+		if(!top) adjacent[count++] = position - row_size;
+		if(!left) adjacent[count++] = position - 1;
+		if(!bottom) adjacent[count++] = position + row_size;
+		type = count < 2 ? "corner" : "side";
+		return count;
+	}
+
+	if((top || bottom) && (left || right)){
+		type = "corner";
+		adjacent[0] = top ? position + row_size : position - row_size;
+		adjacent[1] = left ? position + 1 : position - 1;
+		return 2;
+	}
+
+	type = "side";
+	if(top){
+		adjacent[0] = position + 1; adjacent[1] = position - 1; adjacent[2] = position + row_size;
+	}
+	else if(left){
+		adjacent[0] = position + 1; adjacent[1] = position - row_size; adjacent[2] = position + row_size;
+	}
+	else if(bottom){
+		adjacent[0] = position + 1; adjacent[1] = position - row_size; adjacent[2] = position - 1;
+	}
+	else if(right){
+		adjacent[0] = position - row_size; adjacent[1] = position - 1; adjacent[2] = position + row_size;
+	}
+	else{
+		type = "center";
+		adjacent[0] = position + 1; adjacent[1] = position - row_size; adjacent[2] = position - 1; adjacent[3] = position + row_size;
+		return 4;
+	}
+	return 3;
+}
+
+
+/* FUNCTION: Copies a rectangle of values out, with no locking; get_region_values wraps it in the
+ *           seqlock retry in concurrent mode. Lazy runs that fall in an unwritten tile read the default.
+ * ARGUMENTS: The buffer to fill (height * width values), and the corner and size of a valid rectangle.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void gridgraph<T>::read_region(T * to_get, unsigned int top, unsigned int left, unsigned int height, unsigned int width) const
+{
+	for(unsigned int row = top; row < top + height; ++row)
+	{
+		if(!lazy_tiles)
+		{
+			vertex<T> ** current = gridArray + row * row_size + left;
+			for(unsigned int column = 0; column < width; ++column, ++current, ++to_get)
+				*to_get = tile_locks ? load_cell((*current)->get_value_address()) : (*current)->get_value();
+			continue;
+		}
+
+		for(unsigned int column = left; column < left + width; )
+		{
+			//copy the run of this row that falls in one tile, or fill it with the default
+			unsigned int run = min(left + width, (column / LAZY_TILE_SIZE + 1) * LAZY_TILE_SIZE) - column;
+			const T * cell = find_lazy_cell(row, column);
+			T * out = to_get + column - left;
+			if(!cell)
+				fill(out, out + run, lazy_default);
+			else if(tile_locks)
+				for(unsigned int k = 0; k < run; ++k)
+					out[k] = load_cell(cell + k);
+			else
+				copy(cell, cell + run, out);
+			column += run;
+		}
+		to_get += width;
+	}
+}
+
+
+/* FUNCTION: Copies a rectangle of values in, with no locking; store_region holds the tile locks around
+ *           it in concurrent mode. Lazy runs that only hold the default leave untouched tiles unallocated.
+ * ARGUMENTS: The values (height * width of them), and the corner and size of a valid rectangle.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void gridgraph<T>::write_region(const T * to_set, unsigned int top, unsigned int left, unsigned int height, unsigned int width)
+{
+	for(unsigned int row = top; row < top + height; ++row)
+	{
+		if(!lazy_tiles)
+		{
+			vertex<T> ** current = gridArray + row * row_size + left;
+			for(unsigned int column = 0; column < width; ++column, ++current, ++to_set)
+				store_cell((*current)->get_value_address(), *to_set);
+			continue;
+		}
+
+		for(unsigned int column = left; column < left + width; )
+		{
+			unsigned int run = min(left + width, (column / LAZY_TILE_SIZE + 1) * LAZY_TILE_SIZE) - column;
+			const T * in = to_set + column - left;
+			bool needed = find_lazy_cell(row, column) != NULL;
+			for(unsigned int k = 0; k < run && !needed; ++k)
+				needed = !(in[k] == lazy_default);
+			if(needed){
+				T * cell = cell_address(row, column);
+				for(unsigned int k = 0; k < run; ++k)
+					store_cell(cell + k, in[k]);
+			}
+			column += run;
+		}
+		to_set += width;
+	}
+}
+
+
+/* FUNCTION: Switches the grid into concurrent mode. The grid is cut into square tiles, each guarded by a
+ *           seqlock. The locks cover cells by coordinate, so a lazy graph stays lazy. Must be called
+ *           before the grid is shared between threads.
+ * ARGUMENTS: The number of cells along each side of a tile.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void gridgraph<T>::enable_concurrency(unsigned int size)
+{
+	if(tile_locks)
+		resource->deallocate(tile_locks, tile_count * sizeof(tile_lock), alignof(tile_lock));
+	tile_size = size ? size : 1;
+	tile_columns = (row_size + tile_size - 1) / tile_size;
+	tile_count = tile_columns * ((column_size + tile_size - 1) / tile_size);
+	tile_locks = (tile_lock *) resource->allocate(tile_count * sizeof(tile_lock), alignof(tile_lock));
+	for(unsigned int i = 0; i < tile_count; ++i)
+		new (tile_locks + i) tile_lock();
+}
+
+
+/* FUNCTION: Atomically reads one cell without taking any lock.
+ * ARGUMENTS: The row and column coordinates.
+ * RETURN: The value of the cell.
+ */
+template<class T>
+T gridgraph<T>::atomic_load_at_cord(unsigned int row, unsigned int column) const
+{
+	if(!valid_coordinate(row, column))
+		return (T) NULL;
+	if(lazy_tiles){
+		const T * cell = find_lazy_cell(row, column);
+		return cell ? __atomic_load_n(cell, __ATOMIC_ACQUIRE) : lazy_default;
+	}
+	return __atomic_load_n((*(gridArray + (row * row_size) + column))->get_value_address(), __ATOMIC_ACQUIRE);
+}
+
+
+/* FUNCTION: Atomically writes one cell. In concurrent mode the cell's tile is held (its sequence odd)
+ *           for the instant of the store, so a region snapshot either sees the write or retries.
+ * ARGUMENTS: The value to store and the row and column coordinates.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void gridgraph<T>::atomic_store_at_cord(T to_set, unsigned int row, unsigned int column)
+{
+	if(!valid_coordinate(row, column))
+		return;
+	T * target = cell_address(row, column);
+	lock_cell(row, column);
+	T old_value = __atomic_exchange_n(target, to_set, __ATOMIC_ACQ_REL);
+	unlock_cell(row, column);
+	for(unsigned int i = 0; i < observers.size(); ++i)
+		observers[i]->value_changed(row, column, old_value, to_set);
+}
+
+
+/* FUNCTION: Atomically replaces one cell if it still holds an expected value.
+ * ARGUMENTS: The expected value (updated with the current value on failure), the value to store, and
+ *            the row and column coordinates.
+ * RETURN: True if the value was replaced.
+ */
+template<class T>
+bool gridgraph<T>::compare_exchange_at_cord(T & expected, T desired, unsigned int row, unsigned int column)
+{
+	if(!valid_coordinate(row, column))
+		return false;
+	T * target = cell_address(row, column);
+	lock_cell(row, column);
+	bool swapped = __atomic_compare_exchange_n(target, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+	unlock_cell(row, column);
+	if(!swapped)
+		return false;
+	for(unsigned int i = 0; i < observers.size(); ++i)
+		observers[i]->value_changed(row, column, expected, desired);
+	return true;
+}
+
+
+/* FUNCTION: Atomically adds to one cell.
+ * ARGUMENTS: The amount to add and the row and column coordinates.
+ * RETURN: The value of the cell before the addition.
+ */
+template<class T>
+T gridgraph<T>::fetch_add_at_cord(T to_add, unsigned int row, unsigned int column)
+{
+	if(!valid_coordinate(row, column))
+		return (T) NULL;
+	T * target = cell_address(row, column);
+	lock_cell(row, column);
+	T previous = __atomic_fetch_add(target, to_add, __ATOMIC_ACQ_REL);
+	unlock_cell(row, column);
+	for(unsigned int i = 0; i < observers.size(); ++i)
+		observers[i]->value_changed(row, column, previous, (T) (previous + to_add));
+	return previous;
+}
+
+
+/* FUNCTION: Finds the lock tile that holds a cell.
+ * ARGUMENTS: The row and column coordinates.
+ * RETURN: The tile index.
+ */
+template<class T>
+unsigned int gridgraph<T>::tile_of(unsigned int row, unsigned int column) const
+{
+	return (row / tile_size) * tile_columns + column / tile_size;
+}
+
+
+/* FUNCTION: Takes a tile for writing: waits for an even sequence and moves it to odd.
+ * ARGUMENTS: The tile index.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void gridgraph<T>::lock_tile(unsigned int tile) const
+{
+	atomic<unsigned int> & sequence = tile_locks[tile].sequence;
+	unsigned int current = sequence.load(memory_order_relaxed);
+	for(;;)
+	{
+		if(!(current & 1) && sequence.compare_exchange_weak(current, current + 1, memory_order_acquire, memory_order_relaxed))
+			return;
+		current = sequence.load(memory_order_relaxed);
+	}
+}
+
+
+/* FUNCTION: Releases a tile taken by lock_tile; the sequence becomes even again.
+ * ARGUMENTS: The tile index.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void gridgraph<T>::unlock_tile(unsigned int tile) const
+{
+	tile_locks[tile].sequence.fetch_add(1, memory_order_release);
+}
+
+
+/* FUNCTION: Takes the tile of a cell around a single-cell write, so its sequence is odd while the cell
+ *           changes and region readers cannot validate a snapshot taken in between. Does nothing
+ *           outside concurrent mode.
+ * ARGUMENTS: The row and column coordinates.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void gridgraph<T>::lock_cell(unsigned int row, unsigned int column)
+{
+	if(tile_locks)
+		lock_tile(tile_of(row, column));
+}
+
+
+/* FUNCTION: Releases the tile taken by lock_cell. Does nothing outside concurrent mode.
+ * ARGUMENTS: The row and column coordinates.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void gridgraph<T>::unlock_cell(unsigned int row, unsigned int column)
+{
+	if(tile_locks)
+		unlock_tile(tile_of(row, column));
+}
+
+
+/* FUNCTION: Starts a seqlock read of a tile by waiting until no writer holds it.
+ * ARGUMENTS: The tile index.
+ * RETURN: The even sequence number to compare against once the read is done.
+ */
+template<class T>
+unsigned int gridgraph<T>::read_tile_begin(unsigned int tile) const
+{
+	const atomic<unsigned int> & sequence = tile_locks[tile].sequence;
+	unsigned int current;
+	while((current = sequence.load(memory_order_acquire)) & 1)
+		;
+	return current;
+}
+
+
+
+/* FUNCTION: Builds every vertex of a lazy graph, fills in the values written so far (and the default
+ *           everywhere else), and frees the tiles. Does nothing for a graph that is not lazy. This
+ *           builds rows * columns vertices, and no other thread may use the graph meanwhile.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void gridgraph<T>::materialize(void)
+{
+	if(!lazy_tiles)
+		return;
+
+	T * values = new T[array_length];
+	get_all_values(values);
+	release_lazy_tiles();
+	mode = STORAGE_HEAP;
+
+	//graph_init starts without locks; a concurrent graph keeps the ones it had
+	tile_lock * locks = tile_locks;
+	unsigned int locked_size = tile_size, locked_columns = tile_columns, locked_count = tile_count;
+	graph_init();
+	tile_locks = locks;
+	tile_size = locked_size;
+	tile_columns = locked_columns;
+	tile_count = locked_count;
+	set_all_values(values);
+	delete [] values;
+}
+
+
+/* FUNCTION: Finds the storage of a cell for writing. In lazy mode its tile is allocated if needed.
+ * ARGUMENTS: The row and column coordinates, which must be valid.
+ * RETURN: The address of the cell value.
+ */
+template<class T>
+T * gridgraph<T>::cell_address(unsigned int row, unsigned int column)
+{
+	if(!lazy_tiles)
+		return (*(gridArray + (row * row_size) + column))->get_value_address();
+
+	T * tile = lazy_tile((row / LAZY_TILE_SIZE) * lazy_tile_columns + column / LAZY_TILE_SIZE);
+	return tile + (row % LAZY_TILE_SIZE) * LAZY_TILE_SIZE + column % LAZY_TILE_SIZE;
+}
+
+
+/* FUNCTION: Finds the storage of a cell in lazy mode without allocating anything.
+ * ARGUMENTS: The row and column coordinates, which must be valid.
+ * RETURN: The address of the cell value, or NULL if its tile was never written.
+ */
+template<class T>
+const T * gridgraph<T>::find_lazy_cell(unsigned int row, unsigned int column) const
+{
+	const T * tile = lazy_tiles[(row / LAZY_TILE_SIZE) * lazy_tile_columns + column / LAZY_TILE_SIZE].load(memory_order_acquire);
+	if(!tile)
+		return NULL;
+	return tile + (row % LAZY_TILE_SIZE) * LAZY_TILE_SIZE + column % LAZY_TILE_SIZE;
+}
+
+
+/* FUNCTION: Gets a lazy tile, allocating it from the graph's memory resource and filling it with the
+ *           default value the first time. The new tile is published with a compare-and-swap; if
+ *           another thread published one first, this one is freed and theirs is used.
+ * ARGUMENTS: The tile index.
+ * RETURN: The first value of the tile; values are stored row by row, LAZY_TILE_SIZE per row.
+ */
+template<class T>
+T * gridgraph<T>::lazy_tile(unsigned int index)
+{
+	T * tile = lazy_tiles[index].load(memory_order_acquire);
+	if(tile)
+		return tile;
+
+	T * fresh = (T *) resource->allocate(LAZY_TILE_SIZE * LAZY_TILE_SIZE * sizeof(T), alignof(T));
+	uninitialized_fill(fresh, fresh + LAZY_TILE_SIZE * LAZY_TILE_SIZE, lazy_default);
+	if(lazy_tiles[index].compare_exchange_strong(tile, fresh, memory_order_acq_rel, memory_order_acquire)){
+		lazy_written.fetch_add(1, memory_order_relaxed);
+		return fresh;
+	}
+
+	destroy(fresh, fresh + LAZY_TILE_SIZE * LAZY_TILE_SIZE);
+	resource->deallocate(fresh, LAZY_TILE_SIZE * LAZY_TILE_SIZE * sizeof(T), alignof(T));
+	return tile;
+}
+
+
+/* FUNCTION: Counts the lazy tiles written so far.
+ * ARGUMENTS: No params.
+ * RETURN: The number of tiles holding memory, 0 for a graph that is not lazy.
+ */
+template<class T>
+unsigned int gridgraph<T>::get_materialized_tiles(void) const
+{
+	return lazy_tiles ? lazy_written.load(memory_order_relaxed) : 0;
+}
+
+
+/* FUNCTION: Frees every lazy tile and the tile table.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void gridgraph<T>::release_lazy_tiles(void)
+{
+	if(!lazy_tiles)
+		return;
+
+	for(unsigned int index = 0; index < lazy_tile_count; ++index){
+		T * tile = lazy_tiles[index].load(memory_order_relaxed);
+		if(tile){
+			destroy(tile, tile + LAZY_TILE_SIZE * LAZY_TILE_SIZE);
+			resource->deallocate(tile, LAZY_TILE_SIZE * LAZY_TILE_SIZE * sizeof(T), alignof(T));
+		}
+	}
+	delete [] lazy_tiles;
+	lazy_tiles = NULL;
+}
+
+
+
+/* FUNCTION: Registers an observer to be told about every later write to the grid. Observers run on the
+ *           writing thread, after the write has released its tiles, and are not copied along with the
+ *           graph. Attaching one does not serialize writers. Attach and detach before sharing the grid.
+ * ARGUMENTS: The observer.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void gridgraph<T>::attach_observer(grid_observer<T> * observer)
+{
+	if(find(observers.begin(), observers.end(), observer) == observers.end())
+		observers.push_back(observer);
+}
+
+
+/* FUNCTION: Stops telling an observer about writes.
+ * ARGUMENTS: The observer.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void gridgraph<T>::detach_observer(grid_observer<T> * observer)
+{
+	typename vector<grid_observer<T> *>::iterator found = find(observers.begin(), observers.end(), observer);
+	if(found != observers.end())
+		observers.erase(found);
+}
+
+
+
 template class gridgraph<char>;
 template class vertex<char>;
 template class side<char>;
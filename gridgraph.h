@@ -8,8 +8,15 @@
  * the grid. In this version, diagonally-adjacent squares are NOT tabulated; only those directly
  * adjacent are kept. For example: corners have 2 adjacent vertices; sides have 3; centers have 4.*/
 
+#ifndef GRIDGRAPH_H
+#define GRIDGRAPH_H
+
 #include <cstddef>
 #include <iostream>
+#include <atomic>
+#include <memory_resource>
+#include <vector>
+#include "gridarena.h"
 
 
 using namespace std;
@@ -17,6 +24,11 @@ using namespace std;
 
 const int NUMBER_OF_ROWS = 3;
 const int NUMBER_OF_COLUMNS = 3;
+const unsigned int NO_PATH = (unsigned int) -1; //distance to a cell that cannot be reached
+const unsigned int MAX_CELLS = (unsigned int) -1; //positions are unsigned ints, so rows * columns must fit in one
+const unsigned int DEFAULT_TILE_SIZE = 64; //cells along each side of a lock tile in concurrent mode
+const unsigned int SNAPSHOT_RETRIES = 4; //optimistic region reads before the reader locks the tiles instead
+const unsigned int LAZY_TILE_SIZE = 64; //cells along each side of a tile of values in lazy mode
 
 template<class T>
 class vertex
@@ -25,7 +37,7 @@ class vertex
         vertex(void);
         vertex(const unsigned int & array_position, const unsigned int & row_position, const unsigned int & column_position);
         virtual ~vertex(void);
-        virtual void display(void) = 0;
+        virtual void display(ostream & out = cout) = 0;
         virtual void create_adjacencies(const unsigned int & row_size, const unsigned int & column_size, vertex<T> ** grid) = 0;
 	
 	virtual void expand() = 0;
@@ -35,6 +47,7 @@ class vertex
 
         void set_value(T to_set);
         T get_value(void) const;
+        T * get_value_address(void) { return &value; }
 	
 	unsigned int get_position(void) const;
         unsigned int get_row_pos(void) const;
@@ -57,7 +70,7 @@ class corner : public vertex<T>
     public:
         corner(const unsigned int & array_position, const unsigned int & row_position, const unsigned int & column_position);
         ~corner();
-        void display();
+        void display(ostream & out = cout);
         void create_adjacencies(const unsigned int & row_size, const unsigned int & column_size, vertex<T> ** grid);
 
 	void expand();
@@ -73,7 +86,7 @@ class side : public vertex<T>
     public:
         side(const unsigned int & array_position, const unsigned int & row_position, const unsigned int & column_position);
         ~side();
-        void display();
+        void display(ostream & out = cout);
         void create_adjacencies(const unsigned int & row_size, const unsigned int & column_size, vertex<T> ** grid);
 
 	void expand();
@@ -91,7 +104,7 @@ class center : public vertex<T>
     public:
         center(const unsigned int & array_position, const unsigned int & row_position, const unsigned int & column_position);
         ~center();
-        void display();
+        void display(ostream & out = cout);
         void create_adjacencies(const unsigned int & row_size, const unsigned int & column_size, vertex<T> ** grid);
 
 	void expand();
@@ -105,21 +118,57 @@ class center : public vertex<T>
 
 };
 
+/* Where a gridgraph keeps its vertices: the default memory resource, or an arena the graph owns
+ * (optionally backed by huge pages) so construction is one allocation and destruction one release.
+ * In lazy mode no vertices are built at all: values live in tiles that are only allocated when a
+ * cell in them is first written, and every other cell reads back a default value. The table holds
+ * one pointer per tile (8 bytes per 64x64 cells); a new tile is published with a compare-and-swap,
+ * so finding a tile is one atomic load and threads may write new tiles at the same time. */
+enum storage_mode { STORAGE_HEAP, STORAGE_ARENA, STORAGE_HUGE_PAGES, STORAGE_LAZY };
+
+/* One seqlock per tile of the grid in concurrent mode. The sequence is odd while a writer holds the
+ * tile; every change to a cell of the tile moves it forward, so readers can detect torn reads. The
+ * tiles are laid over coordinates, so they cover lazy graphs as well as eager ones. */
+struct alignas(64) tile_lock
+{
+    atomic<unsigned int> sequence;
+};
+
+/* Abstract base for anything that keeps derived data in step with a gridgraph (indexes, pyramids,
+ * change trackers). An attached observer is told about every write after it happens, on the writing
+ * thread and outside the tile locks, so hooks may read the grid. Writers on different threads notify
+ * side by side, and two writes to one cell may be reported in either order. An observer therefore
+ * guards its own state and, when it matters, re-reads the cells it is told about rather than trust
+ * the old and new values it is handed. */
+template<class T>
+class grid_observer
+{
+    public:
+        virtual ~grid_observer(void) {}
+        virtual void value_changed(unsigned int row, unsigned int column, T old_value, T new_value) = 0;
+        virtual void region_changed(unsigned int top, unsigned int left, unsigned int height, unsigned int width) = 0;
+};
+
 template<class T>
 class gridgraph
 {
     public:
+	typedef bool (*cell_predicate)(T); //tests a cell value, e.g. "is this cell blocked?"
+
 	gridgraph(int = NUMBER_OF_ROWS, int = NUMBER_OF_COLUMNS); //default constructor
         gridgraph(const unsigned int & number_of_rows, const unsigned int & number_of_columns); //argument constructor
+	gridgraph(unsigned int number_of_rows, unsigned int number_of_columns, storage_mode mode, T default_value = T()); //storage mode constructor
+	gridgraph(unsigned int number_of_rows, unsigned int number_of_columns, std::pmr::memory_resource * resource); //allocator constructor
 	gridgraph(const gridgraph<T> &); //copy constructor
         ~gridgraph();
 
-        void display_vertices(void) const;
-        void display_as_grid(void) const;
+        void display_vertices(ostream & out = cout) const;
+        void display_as_grid(ostream & out = cout) const;
 
 	bool valid_coordinate(unsigned int row, unsigned int column) const;
 	bool get_coordinate_by_position(unsigned int position, unsigned int & row, unsigned int & column) const;
 	bool get_position_by_coordinate(unsigned int & position, unsigned int row, unsigned int column) const;
+	unsigned int get_adjacent_positions(unsigned int row, unsigned int column, unsigned int * adjacent, const char * & type) const;
 	
 	T get_value_at_cord(unsigned int row, unsigned int column) const; 
 	void set_value_at_cord(T to_set, unsigned int row, unsigned int column);
@@ -127,9 +176,34 @@ class gridgraph
         void get_all_values(T * to_get) const;
         void set_all_values(T * to_set);
 
+	void get_region_values(T * to_get, unsigned int top, unsigned int left, unsigned int height, unsigned int width) const;
+	void set_region_values(const T * to_set, unsigned int top, unsigned int left, unsigned int height, unsigned int width);
+
+	//concurrent mode: tile seqlocks for readers and writers on separate threads
+	void enable_concurrency(unsigned int tile_size = DEFAULT_TILE_SIZE);
+	bool is_concurrent(void) const { return tile_locks != NULL; }
+
+	//atomic cell operations; T must be a word-sized integral type. In concurrent mode each holds the
+	//cell's tile for the instant of the write, so region snapshots stay consistent
+	T atomic_load_at_cord(unsigned int row, unsigned int column) const;
+	void atomic_store_at_cord(T to_set, unsigned int row, unsigned int column);
+	bool compare_exchange_at_cord(T & expected, T desired, unsigned int row, unsigned int column);
+	T fetch_add_at_cord(T to_add, unsigned int row, unsigned int column);
+
 	unsigned int get_size(void) const { return array_length; }
 	unsigned int get_row_size(void) const { return row_size; }
 	unsigned int get_column_size(void) const { return column_size; }
+	std::pmr::memory_resource * get_resource(void) const { return resource; }
+
+	static size_t storage_bytes(unsigned int number_of_rows, unsigned int number_of_columns); //to size an arena
+
+	void attach_observer(grid_observer<T> * observer);
+	void detach_observer(grid_observer<T> * observer);
+
+	//lazy mode: only tiles that were written hold memory
+	bool is_lazy(void) const { return lazy_tiles != NULL; }
+	unsigned int get_materialized_tiles(void) const;
+	void materialize(void); //builds every vertex and leaves lazy mode; not thread-safe
 		
 
 
@@ -141,8 +215,45 @@ class gridgraph
         unsigned int column_size;
         unsigned int array_length;
 
+        std::pmr::memory_resource * resource;
+        grid_arena * owned_arena;
+        storage_mode mode;
+        char * vertex_storage; //every vertex lives in one slab, one slot per position
+
+        atomic<T *> * lazy_tiles; //one slot per tile, NULL until a cell in the tile is written
+        unsigned int lazy_tile_columns;
+        unsigned int lazy_tile_count;
+        atomic<unsigned int> lazy_written;
+        T lazy_default;
+
+        vector<grid_observer<T> *> observers;
+
+        tile_lock * tile_locks;
+        unsigned int tile_size;
+        unsigned int tile_columns;
+        unsigned int tile_count;
+
     private:
+        void use_storage(storage_mode mode, std::pmr::memory_resource * resource);
         void graph_init();
+        T store_value(T to_set, unsigned int row, unsigned int column);
+        void store_region(const T * to_set, unsigned int top, unsigned int left, unsigned int height, unsigned int width);
+        void read_region(T * to_get, unsigned int top, unsigned int left, unsigned int height, unsigned int width) const;
+        void write_region(const T * to_set, unsigned int top, unsigned int left, unsigned int height, unsigned int width);
+        unsigned int tile_of(unsigned int row, unsigned int column) const;
+        void lock_tile(unsigned int tile) const;
+        void unlock_tile(unsigned int tile) const;
+        void lock_region(unsigned int top, unsigned int left, unsigned int height, unsigned int width) const;
+        void unlock_region(unsigned int top, unsigned int left, unsigned int height, unsigned int width) const;
+        void lock_cell(unsigned int row, unsigned int column);
+        void unlock_cell(unsigned int row, unsigned int column);
+        unsigned int read_tile_begin(unsigned int tile) const;
+        T * cell_address(unsigned int row, unsigned int column);
+        const T * find_lazy_cell(unsigned int row, unsigned int column) const;
+        T * lazy_tile(unsigned int tile);
+        void release_lazy_tiles(void);
         vertex<T> * determine_vertex_type(const unsigned int & position, const unsigned int & row, const unsigned int & column);
 
 };
+
+#endif
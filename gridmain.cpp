@@ -8,8 +8,8 @@ int main()
 	int rows = 5;
 	int columns = 5;
 
-	cout << "Number of rows (column size): " << rows << endl;
-	cout << "Number of columns (row size): " << columns << endl << endl;
+	cout << "Number of rows (column size): " << rows << '\n';
+	cout << "Number of columns (row size): " << columns << "\n\n";
 
 	gridgraph<char> grid(rows, columns);
 
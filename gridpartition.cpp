@@ -0,0 +1,525 @@
+//gridpartition.cpp
+
+/* A grid partitioned across worker processes over shared memory. See 'gridpartition.h' for an overview. */
+
+#include "gridpartition.h"
+#include <new>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+
+const size_t SEGMENT_ALIGNMENT = 64; //each part of the segment starts on a cache line
+
+enum partition_command { PARTITION_EXIT, PARTITION_STENCIL, PARTITION_BFS };
+
+template<class T>
+struct partitioned_grid<T>::shared_control
+{
+    pthread_barrier_t start;   //coordinator and workers, before a command
+    pthread_barrier_t done;    //coordinator and workers, after a command
+    pthread_barrier_t between; //workers only, between the steps or levels of one command
+
+    unsigned int command;
+    unsigned int plane;        //which plane holds the current values
+    unsigned int steps;
+    cell_stencil stencil;
+    T outside;
+    typename gridgraph<T>::cell_predicate is_blocked;
+    unsigned int source;
+    atomic<unsigned int> progress[3]; //cells reached per BFS level, reused round robin
+
+    unsigned int row_cuts[MAX_PARTITIONS + 1];
+    unsigned int column_cuts[MAX_PARTITIONS + 1];
+    double costs[MAX_PARTITIONS * MAX_PARTITIONS]; //seconds of work per block since the last rebalance
+};
+
+
+/* FUNCTION: Maps a shared memory segment that forked workers inherit. The POSIX object is unlinked
+ *           straight away, so it goes when the last process unmaps it; if shm_open is unavailable an
+ *           anonymous shared mapping does the same job.
+ * ARGUMENTS: The size of the segment in bytes.
+ * RETURN: The segment, or NULL if nothing could be mapped.
+ */
+static void * map_segment(size_t bytes)
+{
+    static unsigned int segments = 0;
+    char name[64];
+    snprintf(name, sizeof(name), "/gridpartition-%d-%u", (int) getpid(), segments++);
+
+    void * segment = MAP_FAILED;
+    int descriptor = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(descriptor >= 0){
+        shm_unlink(name);
+        if(ftruncate(descriptor, bytes) == 0)
+            segment = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+        close(descriptor);
+    }
+    if(segment == MAP_FAILED)
+        segment = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    return segment == MAP_FAILED ? NULL : segment;
+}
+
+
+/* FUNCTION: Moves the cut lines along one side of the grid so each band gets the same share of the
+ *           measured cost. A band's cost is spread evenly over its lines, and the new cuts go where the
+ *           running total reaches each share. Every band keeps at least one line.
+ * ARGUMENTS: The cuts (bands + 1 of them), the number of bands, each band's cost, and the grid length.
+ * RETURN: Returns no values.
+ */
+static void balance_cuts(unsigned int * cuts, unsigned int bands, const vector<double> & cost, unsigned int length)
+{
+    vector<double> line(length);
+    double total = 0;
+    for(unsigned int band = 0; band < bands; ++band){
+        for(unsigned int i = cuts[band]; i < cuts[band + 1]; ++i)
+            line[i] = cost[band] / (cuts[band + 1] - cuts[band]);
+        total += cost[band];
+    }
+    if(total <= 0)
+        return;
+
+    vector<unsigned int> fresh(bands + 1, length);
+    fresh[0] = 0;
+    double running = 0;
+    unsigned int band = 1;
+    for(unsigned int i = 0; i < length && band < bands; ++i){
+        running += line[i];
+        while(band < bands && running >= total * band / bands)
+            fresh[band++] = i + 1;
+    }
+
+    for(band = 1; band < bands; ++band)
+        fresh[band] = max(fresh[band], fresh[band - 1] + 1);
+    for(band = bands - 1; band > 0; --band)
+        fresh[band] = min(fresh[band], fresh[band + 1] - 1);
+    copy(fresh.begin(), fresh.end(), cuts);
+}
+
+
+/* FUNCTION: Constructor for the partitioned grid. Maps the shared segment, cuts the grid into even
+ *           blocks and forks one worker process per block. The workers' scratch space is reserved
+ *           before the fork, at the size of the largest block rebalance() can make, so a child
+ *           never calls the allocator: another thread of the parent may have held its lock when
+ *           the fork happened.
+ * ARGUMENTS: The size of the grid, and the number of blocks down and across (each at most
+ *            MAX_PARTITIONS and at most the grid's size on that side).
+ * RETURN: Returns no values. good() is false if the segment or a worker could not be created.
+ */
+template<class T>
+partitioned_grid<T>::partitioned_grid(unsigned int rows_in_grid, unsigned int columns_in_grid, unsigned int down, unsigned int across)
+    : rows(max(1u, rows_in_grid)), columns(max(1u, columns_in_grid)),
+      block_rows(max(1u, min(min(down, MAX_PARTITIONS), rows))), block_columns(max(1u, min(min(across, MAX_PARTITIONS), columns))),
+      control(NULL), mapped_bytes(0), distance_plane(NULL)
+{
+    size_t cells = (size_t) rows * columns;
+    size_t control_bytes = (sizeof(shared_control) + SEGMENT_ALIGNMENT - 1) / SEGMENT_ALIGNMENT * SEGMENT_ALIGNMENT;
+    size_t plane_bytes = (cells * sizeof(T) + SEGMENT_ALIGNMENT - 1) / SEGMENT_ALIGNMENT * SEGMENT_ALIGNMENT;
+    mapped_bytes = control_bytes + 2 * plane_bytes + cells * sizeof(unsigned int);
+    planes[0] = planes[1] = NULL;
+
+    char * segment = (char *) map_segment(mapped_bytes);
+    if(!segment)
+        return;
+    control = new (segment) shared_control;
+    planes[0] = (T *) (segment + control_bytes);
+    planes[1] = (T *) (segment + control_bytes + plane_bytes);
+    distance_plane = (unsigned int *) (segment + control_bytes + 2 * plane_bytes);
+    fill(planes[0], planes[0] + cells, T());
+
+    control->plane = 0;
+    for(unsigned int i = 0; i <= block_rows; ++i)
+        control->row_cuts[i] = (unsigned long long) rows * i / block_rows;
+    for(unsigned int i = 0; i <= block_columns; ++i)
+        control->column_cuts[i] = (unsigned long long) columns * i / block_columns;
+    for(unsigned int i = 0; i < get_block_count(); ++i)
+        control->costs[i] = 0;
+
+    pthread_barrierattr_t shared;
+    pthread_barrierattr_init(&shared);
+    pthread_barrierattr_setpshared(&shared, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(&control->start, &shared, get_block_count() + 1);
+    pthread_barrier_init(&control->done, &shared, get_block_count() + 1);
+    pthread_barrier_init(&control->between, &shared, get_block_count());
+    pthread_barrierattr_destroy(&shared);
+
+    //every band keeps at least one line, so a block never grows past the rest of the grid
+    size_t largest_height = rows - block_rows + 1, largest_width = columns - block_columns + 1;
+    vector<T> tile;
+    vector<unsigned int> frontier, next;
+    tile.reserve((largest_height + 2) * (largest_width + 2));
+    frontier.reserve(largest_height * largest_width);
+    next.reserve(largest_height * largest_width);
+
+    for(unsigned int block = 0; block < get_block_count(); ++block)
+    {
+        pid_t worker = fork();
+        if(worker == 0){
+            run_worker(block, tile, frontier, next);
+            _exit(0);
+        }
+        if(worker < 0)
+            break;
+        workers.push_back(worker);
+    }
+    if(workers.size() == get_block_count())
+        return;
+
+    //not every worker started; the ones that did are waiting on a barrier that can never fill
+    for(unsigned int i = 0; i < workers.size(); ++i){
+        kill(workers[i], SIGKILL);
+        waitpid(workers[i], NULL, 0);
+    }
+    workers.clear();
+    munmap(segment, mapped_bytes);
+    control = NULL;
+}
+
+
+/* FUNCTION: Destructor for the partitioned grid. Tells the workers to exit, waits for them and unmaps
+ *           the segment.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+partitioned_grid<T>::~partitioned_grid()
+{
+    if(!control)
+        return;
+    control->command = PARTITION_EXIT;
+    pthread_barrier_wait(&control->start);
+    for(unsigned int i = 0; i < workers.size(); ++i)
+        waitpid(workers[i], NULL, 0);
+
+    pthread_barrier_destroy(&control->start);
+    pthread_barrier_destroy(&control->done);
+    pthread_barrier_destroy(&control->between);
+    control->~shared_control();
+    munmap(control, mapped_bytes);
+}
+
+
+/* FUNCTION: Looks up the cells a block currently owns.
+ * ARGUMENTS: The block (numbered row by row) and the corner and size to set.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void partitioned_grid<T>::get_block(unsigned int block, unsigned int & top, unsigned int & left, unsigned int & height, unsigned int & width) const
+{
+    unsigned int down = block / block_columns, across = block % block_columns;
+    top = control->row_cuts[down];
+    left = control->column_cuts[across];
+    height = control->row_cuts[down + 1] - top;
+    width = control->column_cuts[across + 1] - left;
+}
+
+
+/* FUNCTION: Reports how long a block's worker has spent working since the last rebalance.
+ * ARGUMENTS: The block.
+ * RETURN: The cost in seconds.
+ */
+template<class T>
+double partitioned_grid<T>::get_block_cost(unsigned int block) const
+{
+    return control && block < get_block_count() ? control->costs[block] : 0;
+}
+
+
+/* FUNCTION: Copies a gridgraph of the same size into the shared plane.
+ * ARGUMENTS: The grid to copy.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void partitioned_grid<T>::load(const gridgraph<T> & grid)
+{
+    if(control && grid.get_column_size() == rows && grid.get_row_size() == columns)
+        grid.get_all_values(planes[control->plane]);
+}
+
+
+/* FUNCTION: Copies the shared plane into a gridgraph of the same size.
+ * ARGUMENTS: The grid to write to.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void partitioned_grid<T>::store(gridgraph<T> & grid) const
+{
+    if(control && grid.get_column_size() == rows && grid.get_row_size() == columns)
+        grid.set_all_values(planes[control->plane]);
+}
+
+
+/* FUNCTION: Reads one cell between commands.
+ * ARGUMENTS: The row and column.
+ * RETURN: The value, or the default value outside the grid.
+ */
+template<class T>
+T partitioned_grid<T>::get_value_at_cord(unsigned int row, unsigned int column) const
+{
+    if(!control || row >= rows || column >= columns)
+        return T();
+    return planes[control->plane][(size_t) row * columns + column];
+}
+
+
+/* FUNCTION: Writes one cell between commands.
+ * ARGUMENTS: The value, the row and the column.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void partitioned_grid<T>::set_value_at_cord(T to_set, unsigned int row, unsigned int column)
+{
+    if(control && row < rows && column < columns)
+        planes[control->plane][(size_t) row * columns + column] = to_set;
+}
+
+
+/* FUNCTION: Runs a five-point stencil over every cell, in parallel across the blocks.
+ * ARGUMENTS: The stencil, the number of steps, and the value neighbours outside the grid read as.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void partitioned_grid<T>::step(cell_stencil stencil, unsigned int steps, T outside)
+{
+    if(!control || steps == 0)
+        return;
+    control->stencil = stencil;
+    control->steps = steps;
+    control->outside = outside;
+    command(PARTITION_STENCIL);
+    control->plane ^= steps & 1;
+}
+
+
+/* FUNCTION: Runs a breadth-first search from one cell over the 4-connected open cells, level by level
+ *           across the blocks.
+ * ARGUMENTS: The source cell, the predicate for blocked cells (NULL blocks nothing), and an array of
+ *            rows * columns distances to fill (NO_PATH where unreachable), which may be NULL.
+ * RETURN: The number of cells reached, including the source.
+ */
+template<class T>
+unsigned int partitioned_grid<T>::distances(unsigned int source_row, unsigned int source_column, typename gridgraph<T>::cell_predicate is_blocked, unsigned int * to_get)
+{
+    if(!control || source_row >= rows || source_column >= columns)
+        return 0;
+    control->is_blocked = is_blocked;
+    control->source = source_row * columns + source_column;
+    command(PARTITION_BFS);
+
+    size_t cells = (size_t) rows * columns;
+    unsigned int reached = 0;
+    for(size_t i = 0; i < cells; ++i){
+        if(to_get)
+            to_get[i] = distance_plane[i];
+        reached += distance_plane[i] != NO_PATH;
+    }
+    return reached;
+}
+
+
+/* FUNCTION: Moves the cut lines so the measured cost is spread evenly, then starts measuring afresh.
+ *           Rows are balanced on the cost of each band of block rows, columns on each band of block
+ *           columns.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void partitioned_grid<T>::rebalance(void)
+{
+    if(!control)
+        return;
+    vector<double> row_cost(block_rows, 0), column_cost(block_columns, 0);
+    for(unsigned int block = 0; block < get_block_count(); ++block){
+        row_cost[block / block_columns] += control->costs[block];
+        column_cost[block % block_columns] += control->costs[block];
+        control->costs[block] = 0;
+    }
+    balance_cuts(control->row_cuts, block_rows, row_cost, rows);
+    balance_cuts(control->column_cuts, block_columns, column_cost, columns);
+}
+
+
+/* FUNCTION: Has every worker run a command and waits for all of them to finish it.
+ * ARGUMENTS: The command.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void partitioned_grid<T>::command(unsigned int to_run)
+{
+    control->command = to_run;
+    for(unsigned int i = 0; i < 3; ++i)
+        control->progress[i].store(0, memory_order_relaxed);
+    pthread_barrier_wait(&control->start);
+    pthread_barrier_wait(&control->done);
+}
+
+
+/* FUNCTION: The loop a worker process runs: wait for a command, run it on the block, add the time it
+ *           spent working (not waiting) to the block's cost, and report back.
+ * ARGUMENTS: The worker's block, and the scratch tile and frontiers reserved before the fork.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void partitioned_grid<T>::run_worker(unsigned int block, vector<T> & tile, vector<unsigned int> & frontier, vector<unsigned int> & next)
+{
+    while(true)
+    {
+        pthread_barrier_wait(&control->start);
+        if(control->command == PARTITION_EXIT)
+            return;
+
+        double busy = 0;
+        if(control->command == PARTITION_STENCIL)
+            for(unsigned int step = 0; step < control->steps; ++step)
+            {
+                if(step)
+                    pthread_barrier_wait(&control->between);
+                chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+                stencil_block(block, step, tile);
+                busy += chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+            }
+        else if(control->command == PARTITION_BFS)
+            bfs_block(block, frontier, next, busy);
+
+        control->costs[block] += busy;
+        pthread_barrier_wait(&control->done);
+    }
+}
+
+
+/* FUNCTION: One stencil step over a block. Copies the block and its one-cell halo from the current
+ *           plane into a private tile, then writes the stencil of every cell into the other plane.
+ * ARGUMENTS: The block, the step number within the command (which picks the planes), and the tile.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void partitioned_grid<T>::stencil_block(unsigned int block, unsigned int step, vector<T> & tile)
+{
+    unsigned int top, left, height, width;
+    get_block(block, top, left, height, width);
+    const T * from = planes[(control->plane + step) & 1];
+    T * to = planes[(control->plane + step + 1) & 1];
+    T outside = control->outside;
+
+    //halo exchange: the rows above and below and the columns either side, owned by the neighbours
+    unsigned int span = width + 2;
+    tile.resize((size_t) (height + 2) * span);
+    for(unsigned int r = 0; r < height + 2; ++r)
+    {
+        T * line = tile.data() + (size_t) r * span;
+        unsigned int row = top + r - 1;
+        if(r == 0 ? top == 0 : row >= rows){
+            fill(line, line + span, outside);
+            continue;
+        }
+        const T * source = from + (size_t) row * columns + left;
+        copy(source, source + width, line + 1);
+        line[0] = left > 0 ? source[-1] : outside;
+        line[width + 1] = left + width < columns ? source[width] : outside;
+    }
+
+    cell_stencil stencil = control->stencil;
+    for(unsigned int r = 0; r < height; ++r)
+    {
+        const T * cell = tile.data() + (size_t) (r + 1) * span + 1;
+        T * target = to + (size_t) (top + r) * columns + left;
+        for(unsigned int c = 0; c < width; ++c, ++cell)
+            target[c] = stencil(*cell, cell[-(long) span], cell[span], cell[-1], cell[1]);
+    }
+}
+
+
+/* FUNCTION: A block's part of a level-synchronous BFS. Each level, the block expands its own frontier
+ *           inside the block, then checks its edge cells against the halo for cells the neighbouring
+ *           blocks reached on the level before. The search ends on the first level where no block
+ *           reached anything. Distances are read and written atomically, since halo cells belong to
+ *           other processes.
+ * ARGUMENTS: The block, two scratch frontiers, and the time spent working to add to.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void partitioned_grid<T>::bfs_block(unsigned int block, vector<unsigned int> & frontier, vector<unsigned int> & next, double & busy)
+{
+    unsigned int top, left, height, width;
+    get_block(block, top, left, height, width);
+    unsigned int bottom = top + height, right = left + width;
+    const T * values = planes[control->plane];
+    typename gridgraph<T>::cell_predicate is_blocked = control->is_blocked;
+    unsigned int * distance = distance_plane;
+
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    frontier.clear();
+    for(unsigned int row = top; row < bottom; ++row)
+        for(unsigned int column = left; column < right; ++column)
+            __atomic_store_n(distance + (size_t) row * columns + column, NO_PATH, __ATOMIC_RELAXED);
+    unsigned int source_row = control->source / columns, source_column = control->source % columns;
+    if(source_row >= top && source_row < bottom && source_column >= left && source_column < right
+            && !(is_blocked && is_blocked(values[control->source]))){
+        __atomic_store_n(distance + control->source, 0, __ATOMIC_RELAXED);
+        frontier.push_back(control->source);
+    }
+    busy += chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    pthread_barrier_wait(&control->between);
+
+    for(unsigned int level = 0; ; ++level)
+    {
+        begin = chrono::steady_clock::now();
+        next.clear();
+
+        //inside the block
+        for(unsigned int i = 0; i < frontier.size(); ++i)
+        {
+            unsigned int row = frontier[i] / columns, column = frontier[i] % columns;
+            unsigned int adjacent[4];
+            unsigned int count = 0;
+            if(row > top) adjacent[count++] = frontier[i] - columns;
+            if(row + 1 < bottom) adjacent[count++] = frontier[i] + columns;
+            if(column > left) adjacent[count++] = frontier[i] - 1;
+            if(column + 1 < right) adjacent[count++] = frontier[i] + 1;
+            for(unsigned int k = 0; k < count; ++k)
+                if(__atomic_load_n(distance + adjacent[k], __ATOMIC_RELAXED) == NO_PATH && !(is_blocked && is_blocked(values[adjacent[k]]))){
+                    __atomic_store_n(distance + adjacent[k], level + 1, __ATOMIC_RELAXED);
+                    next.push_back(adjacent[k]);
+                }
+        }
+
+        //across the halo: edge cells next to a cell another block reached on this level
+        for(unsigned int row = top; row < bottom; ++row)
+            for(unsigned int column = left; column < right; column += (row == top || row + 1 == bottom) ? 1 : max(1u, width - 1))
+            {
+                unsigned int cell = row * columns + column;
+                if(__atomic_load_n(distance + cell, __ATOMIC_RELAXED) != NO_PATH || (is_blocked && is_blocked(values[cell])))
+                    continue;
+                bool reached = (row == top && row > 0 && __atomic_load_n(distance + cell - columns, __ATOMIC_RELAXED) == level)
+                            || (row + 1 == bottom && row + 1 < rows && __atomic_load_n(distance + cell + columns, __ATOMIC_RELAXED) == level)
+                            || (column == left && column > 0 && __atomic_load_n(distance + cell - 1, __ATOMIC_RELAXED) == level)
+                            || (column + 1 == right && column + 1 < columns && __atomic_load_n(distance + cell + 1, __ATOMIC_RELAXED) == level);
+                if(reached){
+                    __atomic_store_n(distance + cell, level + 1, __ATOMIC_RELAXED);
+                    next.push_back(cell);
+                }
+            }
+
+        control->progress[level % 3].fetch_add(next.size(), memory_order_relaxed);
+        busy += chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        pthread_barrier_wait(&control->between);
+
+        //everyone reads this level's total; the slot two levels on was last read a level ago
+        unsigned int total = control->progress[level % 3].load(memory_order_relaxed);
+        if(block == 0)
+            control->progress[(level + 2) % 3].store(0, memory_order_relaxed);
+        if(total == 0)
+            return;
+        frontier.swap(next);
+    }
+}
+
+
+
+template class partitioned_grid<char>;
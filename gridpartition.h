@@ -0,0 +1,83 @@
+//gridpartition.h
+
+/* A grid split into rectangular blocks, each owned by its own worker process on the same machine.
+ * The cell values live in a POSIX shared memory segment as two planes. Each step reads one plane and
+ * writes the other. The segment also holds a plane of BFS distances and a control block with the cut
+ * lines and process-shared barriers.
+ *
+ * The calling process is the coordinator. It loads and stores values between steps and sends each
+ * command to the workers. For a stencil step, a worker copies its block plus a one-cell halo (the
+ * rows and columns its neighbours own along its edges) from the current plane into a private tile,
+ * runs the stencil on the tile and writes its block into the next plane. A BFS is level-synchronous:
+ * each level, a worker advances the frontier inside its block and picks up frontier cells in the halo
+ * that other blocks reached on the level before.
+ *
+ * Every worker times its share of each command. rebalance() moves the cut lines so every band of
+ * block rows and of block columns gets the same share of the measured cost. The values stay where
+ * they are, because only ownership moves. With one partition, the same code runs with a single
+ * worker, which gives a baseline to check the split grid against.
+ *
+ * The workers are forked by the constructor, and a child keeps only the thread that forked it. The
+ * workers allocate nothing after the fork, so the grid may be built while other threads run. The
+ * stencil and the blocking predicate run in the workers, so they must not allocate or take locks
+ * either. */
+
+#ifndef GRIDPARTITION_H
+#define GRIDPARTITION_H
+
+#include "gridgraph.h"
+#include <vector>
+#include <sys/types.h>
+
+
+const unsigned int MAX_PARTITIONS = 16; //blocks along each side of the grid
+
+template<class T>
+class partitioned_grid
+{
+    public:
+        typedef T (*cell_stencil)(T center, T up, T down, T left, T right);
+
+        partitioned_grid(unsigned int rows, unsigned int columns, unsigned int block_rows = 1, unsigned int block_columns = 1);
+        ~partitioned_grid();
+
+        bool good(void) const { return control != NULL; }
+        unsigned int get_rows(void) const { return rows; }
+        unsigned int get_columns(void) const { return columns; }
+        unsigned int get_block_count(void) const { return block_rows * block_columns; }
+        void get_block(unsigned int block, unsigned int & top, unsigned int & left, unsigned int & height, unsigned int & width) const;
+        double get_block_cost(unsigned int block) const;
+
+        void load(const gridgraph<T> & grid);
+        void store(gridgraph<T> & grid) const;
+        T get_value_at_cord(unsigned int row, unsigned int column) const;
+        void set_value_at_cord(T to_set, unsigned int row, unsigned int column);
+
+        void step(cell_stencil stencil, unsigned int steps = 1, T outside = T());
+        unsigned int distances(unsigned int source_row, unsigned int source_column, typename gridgraph<T>::cell_predicate is_blocked, unsigned int * to_get);
+        void rebalance(void);
+
+    private:
+        partitioned_grid(const partitioned_grid &);             //the workers and the segment belong to one owner
+        partitioned_grid & operator=(const partitioned_grid &);
+
+        struct shared_control; //lives at the start of the shared segment
+
+        unsigned int rows;
+        unsigned int columns;
+        unsigned int block_rows;
+        unsigned int block_columns;
+
+        shared_control * control;
+        size_t mapped_bytes;
+        T * planes[2];
+        unsigned int * distance_plane;
+        vector<pid_t> workers;
+
+        void command(unsigned int to_run);
+        void run_worker(unsigned int block, vector<T> & tile, vector<unsigned int> & frontier, vector<unsigned int> & next);
+        void stencil_block(unsigned int block, unsigned int step, vector<T> & tile);
+        void bfs_block(unsigned int block, vector<unsigned int> & frontier, vector<unsigned int> & next, double & busy);
+};
+
+#endif
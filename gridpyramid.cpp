@@ -0,0 +1,319 @@
+//gridpyramid.cpp
+
+/* Multi-resolution pyramid of gridgraph values. See 'gridpyramid.h' for an overview. */
+
+#include "gridpyramid.h"
+#include <thread>
+#include <algorithm>
+
+
+const unsigned int ROWS_PER_THREAD = 64; //each build thread gets at least this many rows of a level
+
+
+/* FUNCTION: Constructor for the pyramid. Works out the size of every level, attaches to the grid and
+ *           builds all levels.
+ * ARGUMENTS: The grid, the 2x2 reduction, the predicate PYRAMID_ANY counts as blocked (NULL counts
+ *            every non-default value), and the number of build threads (0 picks one per hardware thread).
+ * RETURN: Returns no values.
+ */
+template<class T>
+grid_pyramid<T>::grid_pyramid(gridgraph<T> & to_reduce, pyramid_operator op, typename gridgraph<T>::cell_predicate blocked, unsigned int count)
+    : grid(to_reduce), reduction(op), is_blocked(blocked), threads(count ? count : max(1u, thread::hardware_concurrency()))
+{
+    unsigned int rows = grid.get_column_size(), columns = grid.get_row_size();
+    level_rows.push_back(rows);
+    level_columns.push_back(columns);
+    while(rows > 1 || columns > 1){
+        rows = (rows + 1) / 2;
+        columns = (columns + 1) / 2;
+        level_rows.push_back(rows);
+        level_columns.push_back(columns);
+    }
+
+    levels.resize(level_rows.size());
+    for(unsigned int level = 1; level < levels.size(); ++level)
+        levels[level].resize(level_rows[level] * level_columns[level]);
+
+    grid.attach_observer(this);
+    rebuild();
+}
+
+
+/* FUNCTION: Destructor for the pyramid. Detaches it from the grid.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+grid_pyramid<T>::~grid_pyramid()
+{
+    grid.detach_observer(this);
+}
+
+
+/* FUNCTION: Observer hook for a single write. Recomputes the block over the cell at every level, from
+ *           the bottom up: O(log N) blocks of four reads each.
+ * ARGUMENTS: The changed cell and its old and new values.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void grid_pyramid<T>::value_changed(unsigned int row, unsigned int column, T old_value, T new_value)
+{
+    lock_guard<mutex> hold(guard);
+    for(unsigned int level = 1; level < levels.size(); ++level){
+        row /= 2;
+        column /= 2;
+        long long & block = levels[level][row * level_columns[level] + column];
+        long long updated = compute_block(level, row, column, NULL);
+        if(block == updated)
+            return; //nothing above can change either
+        block = updated;
+    }
+}
+
+
+/* FUNCTION: Observer hook for a rectangle write. Recomputes the blocks over the rectangle at every
+ *           level; a write over most of the grid rebuilds the whole pyramid instead.
+ * ARGUMENTS: The changed rectangle.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void grid_pyramid<T>::region_changed(unsigned int top, unsigned int left, unsigned int height, unsigned int width)
+{
+    if(height == 0 || width == 0)
+        return;
+    lock_guard<mutex> hold(guard);
+    if((unsigned long long) height * width * 4 > (unsigned long long) level_rows[0] * level_columns[0]){
+        build_levels();
+        return;
+    }
+
+    unsigned int bottom = top + height - 1, right = left + width - 1;
+    for(unsigned int level = 1; level < levels.size(); ++level)
+    {
+        top /= 2; left /= 2; bottom /= 2; right /= 2;
+        for(unsigned int row = top; row <= bottom; ++row)
+            for(unsigned int column = left; column <= right; ++column)
+                levels[level][row * level_columns[level] + column] = compute_block(level, row, column, NULL);
+    }
+}
+
+
+/* FUNCTION: Rebuilds every level from the grid.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void grid_pyramid<T>::rebuild(void)
+{
+    lock_guard<mutex> hold(guard);
+    build_levels();
+}
+
+
+/* FUNCTION: Does the rebuild from a snapshot of the grid. Each level is split into bands of rows built
+ *           on separate threads; the levels themselves go one after another. The caller holds the mutex.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void grid_pyramid<T>::build_levels(void)
+{
+    vector<T> base(grid.get_size());
+    grid.get_all_values(base.data());
+
+    for(unsigned int level = 1; level < levels.size(); ++level)
+    {
+        unsigned int rows = level_rows[level];
+        unsigned int workers = min(threads, max(1u, rows / ROWS_PER_THREAD));
+        if(workers == 1){
+            build_rows(level, 0, rows, base.data());
+            continue;
+        }
+
+        vector<thread> pool;
+        for(unsigned int w = 0; w < workers; ++w)
+            pool.push_back(thread(&grid_pyramid<T>::build_rows, this, level, rows * w / workers, rows * (w + 1) / workers, base.data()));
+        for(unsigned int w = 0; w < workers; ++w)
+            pool[w].join();
+    }
+}
+
+
+/* FUNCTION: Looks up the reduced value of one block.
+ * ARGUMENTS: The level (0 is the grid) and the row and column of the block within that level.
+ * RETURN: The reduced value, or 0 outside the pyramid.
+ */
+template<class T>
+long long grid_pyramid<T>::block_value(unsigned int level, unsigned int row, unsigned int column) const
+{
+    lock_guard<mutex> hold(guard);
+    return stored_value(level, row, column);
+}
+
+
+/* FUNCTION: Does the lookup for block_value and search. The caller holds the mutex.
+ * ARGUMENTS: The level (0 is the grid) and the row and column of the block within that level.
+ * RETURN: The reduced value, or 0 outside the pyramid.
+ */
+template<class T>
+long long grid_pyramid<T>::stored_value(unsigned int level, unsigned int row, unsigned int column) const
+{
+    if(level >= levels.size() || row >= level_rows[level] || column >= level_columns[level])
+        return 0;
+    if(level == 0)
+        return cell_value(grid.get_value_at_cord(row, column));
+    return levels[level][row * level_columns[level] + column];
+}
+
+
+/* FUNCTION: Asks whether any cell under a block is blocked (for a PYRAMID_ANY pyramid).
+ * ARGUMENTS: The level and the row and column of the block within that level.
+ * RETURN: True if the block is nonzero.
+ */
+template<class T>
+bool grid_pyramid<T>::any_blocked(unsigned int level, unsigned int row, unsigned int column) const
+{
+    return block_value(level, row, column) != 0;
+}
+
+
+/* FUNCTION: Asks whether any cell of a grid rectangle is blocked (for a PYRAMID_ANY pyramid). Descends
+ *           from the root and stops at the coarsest blocks that are empty or lie wholly inside.
+ * ARGUMENTS: The top-left corner and size of the rectangle in grid cells.
+ * RETURN: True if some cell in the rectangle is blocked.
+ */
+template<class T>
+bool grid_pyramid<T>::any_blocked_in(unsigned int top, unsigned int left, unsigned int height, unsigned int width) const
+{
+    if(height == 0 || width == 0 || top >= level_rows[0] || left >= level_columns[0])
+        return false;
+    unsigned int bottom = min(top + height, level_rows[0]);
+    unsigned int right = min(left + width, level_columns[0]);
+    lock_guard<mutex> hold(guard);
+    return search(levels.size() - 1, 0, 0, top, left, bottom, right);
+}
+
+
+/* FUNCTION: Copies out a whole level, row by row, e.g. to render the grid at a coarser resolution.
+ * ARGUMENTS: The level and a buffer of get_level_rows(level) * get_level_columns(level) values.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void grid_pyramid<T>::get_level_values(unsigned int level, long long * to_get) const
+{
+    if(level >= levels.size())
+        return;
+    if(level > 0){
+        lock_guard<mutex> hold(guard);
+        copy(levels[level].begin(), levels[level].end(), to_get);
+        return;
+    }
+
+    vector<T> base(grid.get_size());
+    grid.get_all_values(base.data());
+    for(unsigned int i = 0; i < base.size(); ++i)
+        to_get[i] = cell_value(base[i]);
+}
+
+
+/* FUNCTION: Maps a grid value to the value the pyramid reduces.
+ * ARGUMENTS: The grid value.
+ * RETURN: The value itself, or 0/1 for PYRAMID_ANY.
+ */
+template<class T>
+long long grid_pyramid<T>::cell_value(T value) const
+{
+    if(reduction != PYRAMID_ANY)
+        return (long long) value;
+    if(is_blocked)
+        return is_blocked(value) ? 1 : 0;
+    return value == T() ? 0 : 1;
+}
+
+
+/* FUNCTION: Combines two values with the pyramid's reduction.
+ * ARGUMENTS: The two values.
+ * RETURN: The combined value.
+ */
+template<class T>
+long long grid_pyramid<T>::reduce(long long a, long long b) const
+{
+    switch(reduction)
+    {
+        case PYRAMID_MIN: return min(a, b);
+        case PYRAMID_SUM: return a + b;
+        default:          return max(a, b); //max, and "any" over 0/1
+    }
+}
+
+
+/* FUNCTION: Reduces the (up to) four children of one block.
+ * ARGUMENTS: The level and position of the block, and a snapshot of the grid values to read level 0
+ *            from (NULL reads the grid itself).
+ * RETURN: The reduced value.
+ */
+template<class T>
+long long grid_pyramid<T>::compute_block(unsigned int level, unsigned int row, unsigned int column, const T * base) const
+{
+    unsigned int below = level - 1;
+    unsigned int rows = level_rows[below], columns = level_columns[below];
+    unsigned int last_row = min(2 * row + 2, rows), last_column = min(2 * column + 2, columns);
+
+    bool first = true;
+    long long result = 0;
+    for(unsigned int r = 2 * row; r < last_row; ++r)
+        for(unsigned int c = 2 * column; c < last_column; ++c)
+        {
+            long long child;
+            if(below > 0)
+                child = levels[below][r * columns + c];
+            else
+                child = cell_value(base ? base[r * columns + c] : grid.get_value_at_cord(r, c));
+            result = first ? child : reduce(result, child);
+            first = false;
+        }
+    return result;
+}
+
+
+/* FUNCTION: Builds a band of rows of one level from the level below it.
+ * ARGUMENTS: The level, the first and one-past-last row of the band, and the grid snapshot.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void grid_pyramid<T>::build_rows(unsigned int level, unsigned int first, unsigned int last, const T * base)
+{
+    unsigned int columns = level_columns[level];
+    for(unsigned int row = first; row < last; ++row)
+        for(unsigned int column = 0; column < columns; ++column)
+            levels[level][row * columns + column] = compute_block(level, row, column, base);
+}
+
+
+/* FUNCTION: Recursive step of any_blocked_in.
+ * ARGUMENTS: The level and position of the block, and the rectangle as [top, bottom) x [left, right).
+ * RETURN: True if some blocked cell under this block lies in the rectangle.
+ */
+template<class T>
+bool grid_pyramid<T>::search(unsigned int level, unsigned int row, unsigned int column,
+                             unsigned int top, unsigned int left, unsigned int bottom, unsigned int right) const
+{
+    unsigned long long block_top = (unsigned long long) row << level, block_left = (unsigned long long) column << level;
+    unsigned long long block_bottom = (unsigned long long) (row + 1) << level, block_right = (unsigned long long) (column + 1) << level;
+    if(block_top >= bottom || block_left >= right || block_bottom <= top || block_right <= left)
+        return false;
+    if(stored_value(level, row, column) == 0)
+        return false;
+    if(level == 0 || (block_top >= top && block_left >= left && block_bottom <= bottom && block_right <= right))
+        return true;
+
+    for(unsigned int r = 2 * row; r < min(2 * row + 2, level_rows[level - 1]); ++r)
+        for(unsigned int c = 2 * column; c < min(2 * column + 2, level_columns[level - 1]); ++c)
+            if(search(level - 1, r, c, top, left, bottom, right))
+                return true;
+    return false;
+}
+
+
+
+template class grid_pyramid<char>;
@@ -0,0 +1,67 @@
+//gridpyramid.h
+
+/* Multi-resolution pyramid (mipmap) of the values of a gridgraph. Level 0 is the grid itself; each
+ * level above it holds one value per 2x2 block of the level below, reduced with min, max, sum or
+ * "any". Blocks at the ragged right and bottom edges only reduce the children that exist, so a block
+ * at level k always covers the grid cells of a 2^k by 2^k square clipped to the grid. The pyramid
+ * attaches to the grid as an observer: a single write recomputes the one block above it at every
+ * level, and a region write recomputes the blocks over that region. Large writes rebuild the whole
+ * pyramid in parallel. With PYRAMID_ANY each cell counts as 1 if the "blocked" predicate holds, so a
+ * block is nonzero exactly when some cell under it is blocked.
+ *
+ * The pyramid may be queried from other threads while the grid is written. It holds its own mutex
+ * around every update and query, and recomputes blocks from the cells, so hooks from writers on
+ * different threads may arrive in any order. */
+
+#ifndef GRIDPYRAMID_H
+#define GRIDPYRAMID_H
+
+#include "gridgraph.h"
+#include <vector>
+#include <mutex>
+
+
+enum pyramid_operator { PYRAMID_MIN, PYRAMID_MAX, PYRAMID_SUM, PYRAMID_ANY };
+
+template<class T>
+class grid_pyramid : public grid_observer<T>
+{
+    public:
+        grid_pyramid(gridgraph<T> & grid, pyramid_operator reduction, typename gridgraph<T>::cell_predicate is_blocked = NULL, unsigned int threads = 0);
+        ~grid_pyramid();
+
+        void value_changed(unsigned int row, unsigned int column, T old_value, T new_value);
+        void region_changed(unsigned int top, unsigned int left, unsigned int height, unsigned int width);
+        void rebuild(void);
+
+        unsigned int get_level_count(void) const { return level_rows.size(); }
+        unsigned int get_level_rows(unsigned int level) const { return level < level_rows.size() ? level_rows[level] : 0; }
+        unsigned int get_level_columns(unsigned int level) const { return level < level_columns.size() ? level_columns[level] : 0; }
+
+        long long block_value(unsigned int level, unsigned int row, unsigned int column) const;
+        bool any_blocked(unsigned int level, unsigned int row, unsigned int column) const;
+        bool any_blocked_in(unsigned int top, unsigned int left, unsigned int height, unsigned int width) const;
+        void get_level_values(unsigned int level, long long * to_get) const;
+
+    private:
+        gridgraph<T> & grid;
+        pyramid_operator reduction;
+        typename gridgraph<T>::cell_predicate is_blocked;
+        unsigned int threads;
+
+        vector<unsigned int> level_rows;
+        vector<unsigned int> level_columns;
+        vector< vector<long long> > levels; //levels[0] stays empty; level 0 is read from the grid
+        mutable mutex guard;                //held around every update and query of the levels
+
+        void build_levels(void);
+        long long stored_value(unsigned int level, unsigned int row, unsigned int column) const;
+        long long cell_value(T value) const;
+        long long reduce(long long a, long long b) const;
+        long long compute_block(unsigned int level, unsigned int row, unsigned int column, const T * base) const;
+        void build_rows(unsigned int level, unsigned int first, unsigned int last, const T * base);
+        bool search(unsigned int level, unsigned int row, unsigned int column,
+                    unsigned int top, unsigned int left, unsigned int bottom, unsigned int right) const;
+};
+
+#endif
@@ -0,0 +1,586 @@
+//hpagraph.cpp
+
+/* Hierarchical pathfinding (HPA*) layer over a gridgraph. See 'hpagraph.h' for an overview. */
+
+#include "hpagraph.h"
+#include <queue>
+#include <unordered_map>
+#include <functional>
+#include <algorithm>
+
+
+const unsigned int SHORT_ENTRANCE = 6; //open runs shorter than this get a single, centered entrance
+
+
+/* FUNCTION: Constructor for the hierarchical layer. Reads every cell of the grid once, builds the
+ *           entrances and cached intra-cluster distances of every cluster, and attaches to the grid.
+ * ARGUMENTS: The grid to search, a predicate that marks a cell value as impassable, and the number of
+ *            cells along each side of a cluster.
+ * RETURN: Returns no values.
+ */
+template<class T>
+hpagraph<T>::hpagraph(gridgraph<T> & to_search, typename gridgraph<T>::cell_predicate blocked, unsigned int size)
+    : grid(to_search), is_blocked(blocked), rows(to_search.get_column_size()), columns(to_search.get_row_size()), cluster_size(size ? size : 1)
+{
+    cluster_rows = (rows + cluster_size - 1) / cluster_size;
+    cluster_columns = (columns + cluster_size - 1) / cluster_size;
+
+    vector<T> values(grid.get_size());
+    grid.get_all_values(values.data());
+    open.resize(values.size());
+    for(unsigned int i = 0; i < values.size(); ++i)
+        open[i] = !is_blocked(values[i]);
+
+    clusters.resize(cluster_rows * cluster_columns);
+    vertical_borders.resize(clusters.size());
+    horizontal_borders.resize(clusters.size());
+    local_distance.resize(cluster_size * cluster_size);
+    local_parent.resize(cluster_size * cluster_size);
+    local_queue.resize(cluster_size * cluster_size);
+
+    for(unsigned int cr = 0; cr < cluster_rows; ++cr)
+        for(unsigned int cc = 0; cc < cluster_columns; ++cc){
+            build_vertical_border(cr, cc);
+            build_horizontal_border(cr, cc);
+        }
+
+    for(unsigned int id = 0; id < clusters.size(); ++id)
+        build_cluster(id);
+
+    grid.attach_observer(this);
+}
+
+
+/* FUNCTION: Destructor for the hierarchical layer. Detaches it from the grid.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+hpagraph<T>::~hpagraph()
+{
+    grid.detach_observer(this);
+}
+
+
+/* FUNCTION: Observer hooks. Each changed cell is re-read from the grid, so the hooks need not arrive
+ *           in the order the writes happened.
+ * ARGUMENTS: The changed cell (and its old and new values), or the changed rectangle.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void hpagraph<T>::value_changed(unsigned int row, unsigned int column, T old_value, T new_value)
+{
+    lock_guard<mutex> hold(guard);
+    cell_changed(row, column);
+}
+
+template<class T>
+void hpagraph<T>::region_changed(unsigned int top, unsigned int left, unsigned int height, unsigned int width)
+{
+    lock_guard<mutex> hold(guard);
+    for(unsigned int row = top; row < top + height; ++row)
+        for(unsigned int column = left; column < left + width; ++column)
+            cell_changed(row, column);
+}
+
+
+/* FUNCTION: Re-reads one cell from the grid after its value was changed. If its passability changed,
+ *           its cluster is marked dirty and will be recomputed before the next query. The caller holds
+ *           the mutex.
+ * ARGUMENTS: The row and column of the changed cell.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void hpagraph<T>::cell_changed(unsigned int row, unsigned int column)
+{
+    if(row >= rows || column >= columns)
+        return;
+
+    unsigned int position = row * columns + column;
+    bool now_open = !is_blocked(grid.get_value_at_cord(row, column));
+    if(open[position] == now_open)
+        return;
+
+    open[position] = now_open;
+    clusters[cluster_of(position)].dirty = true;
+}
+
+
+/* FUNCTION: Recomputes the clusters touched since the last rebuild. Queries do this on their own.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void hpagraph<T>::rebuild_dirty(void)
+{
+    lock_guard<mutex> hold(guard);
+    rebuild_clusters();
+}
+
+
+/* FUNCTION: Recomputes the borders of every dirty cluster, and the entrances and cached distances of
+ *           those clusters and of their direct neighbours (which share the recomputed borders). The
+ *           caller holds the mutex.
+ * ARGUMENTS: No params.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void hpagraph<T>::rebuild_clusters(void)
+{
+    vector<bool> rebuild(clusters.size(), false);
+    bool any = false;
+
+    for(unsigned int id = 0; id < clusters.size(); ++id)
+    {
+        if(!clusters[id].dirty)
+            continue;
+
+        unsigned int cr = id / cluster_columns;
+        unsigned int cc = id % cluster_columns;
+        build_vertical_border(cr, cc);
+        build_horizontal_border(cr, cc);
+        rebuild[id] = true;
+        if(cc > 0){
+            build_vertical_border(cr, cc - 1);
+            rebuild[id - 1] = true;
+        }
+        if(cr > 0){
+            build_horizontal_border(cr - 1, cc);
+            rebuild[id - cluster_columns] = true;
+        }
+        if(cc + 1 < cluster_columns)
+            rebuild[id + 1] = true;
+        if(cr + 1 < cluster_rows)
+            rebuild[id + cluster_columns] = true;
+        any = true;
+    }
+
+    if(!any)
+        return;
+
+    for(unsigned int id = 0; id < clusters.size(); ++id)
+        if(rebuild[id])
+            build_cluster(id);
+}
+
+
+/* FUNCTION: Counts the entrance vertices of the abstract graph.
+ * ARGUMENTS: No params.
+ * RETURN: The number of abstract vertices.
+ */
+template<class T>
+unsigned int hpagraph<T>::get_entrance_count(void) const
+{
+    lock_guard<mutex> hold(guard);
+    unsigned int count = 0;
+    for(unsigned int id = 0; id < clusters.size(); ++id)
+        count += clusters[id].nodes.size();
+    return count;
+}
+
+
+/* FUNCTION: Finds a path between two cells. The abstract graph is searched with A* first; each of its
+ *           edges is then refined into grid steps inside a single cluster.
+ * ARGUMENTS: The start and goal coordinates, and a vector that receives the grid positions along the path.
+ * RETURN: The number of steps in the path, or NO_PATH if the goal cannot be reached.
+ */
+template<class T>
+unsigned int hpagraph<T>::find_path(unsigned int start_row, unsigned int start_column,
+                                    unsigned int goal_row, unsigned int goal_column, vector<unsigned int> & path)
+{
+    path.clear();
+    if(start_row >= rows || start_column >= columns || goal_row >= rows || goal_column >= columns)
+        return NO_PATH;
+
+    lock_guard<mutex> hold(guard);
+    rebuild_clusters();
+
+    unsigned int start = start_row * columns + start_column;
+    unsigned int goal = goal_row * columns + goal_column;
+    if(!open[start] || !open[goal])
+        return NO_PATH;
+
+    path.push_back(start);
+    if(start == goal)
+        return 0;
+
+    unsigned int start_cluster = cluster_of(start);
+    unsigned int goal_cluster = cluster_of(goal);
+    unsigned int top, left, bottom, right;
+
+    //distances from the start to the entrances of its cluster (and to the goal if it is local)
+    cluster_search(start_cluster, start);
+    cluster_bounds(start_cluster, top, left, bottom, right);
+    unsigned int width = right - left;
+    if(start_cluster == goal_cluster && local_distance[(goal_row - top) * width + goal_column - left] != NO_PATH){
+        refine(start, goal, path);
+        return path.size() - 1;
+    }
+    const cluster & first = clusters[start_cluster];
+    vector<unsigned int> from_start(first.nodes.size());
+    for(unsigned int i = 0; i < first.nodes.size(); ++i)
+        from_start[i] = local_distance[(first.nodes[i] / columns - top) * width + first.nodes[i] % columns - left];
+
+    //distances from the entrances of the goal cluster to the goal
+    cluster_search(goal_cluster, goal);
+    cluster_bounds(goal_cluster, top, left, bottom, right);
+    width = right - left;
+    const cluster & last = clusters[goal_cluster];
+    vector<unsigned int> to_goal(last.nodes.size());
+    for(unsigned int i = 0; i < last.nodes.size(); ++i)
+        to_goal[i] = local_distance[(last.nodes[i] / columns - top) * width + last.nodes[i] % columns - left];
+
+    //A* over the abstract graph
+    typedef pair<unsigned int, unsigned int> entry;
+    priority_queue<entry, vector<entry>, greater<entry> > frontier;
+    unordered_map<unsigned int, unsigned int> cost;
+    unordered_map<unsigned int, unsigned int> parent;
+
+    cost[start] = 0;
+    frontier.push(entry(heuristic(start, goal), start));
+    bool found = false;
+
+    while(!frontier.empty())
+    {
+        unsigned int current = frontier.top().second;
+        unsigned int current_cost = frontier.top().first - heuristic(current, goal);
+        frontier.pop();
+        if(current_cost > cost[current])
+            continue;
+        if(current == goal){
+            found = true;
+            break;
+        }
+
+        vector<entry> edges;
+        unsigned int id = cluster_of(current);
+        const cluster & here = clusters[id];
+        if(current == start)
+            for(unsigned int i = 0; i < here.nodes.size(); ++i)
+                edges.push_back(entry(from_start[i], here.nodes[i]));
+
+        unsigned int index = node_index(here, current);
+        if(index != NO_PATH)
+        {
+            unsigned int count = here.nodes.size();
+            for(unsigned int i = 0; i < count; ++i)
+                edges.push_back(entry(here.distances[index * count + i], here.nodes[i]));
+            for(unsigned int i = 0; i < here.partners[index].size(); ++i)
+                edges.push_back(entry(1, here.partners[index][i]));
+            if(id == goal_cluster)
+                edges.push_back(entry(to_goal[index], goal));
+        }
+
+        for(unsigned int i = 0; i < edges.size(); ++i)
+        {
+            if(edges[i].first == NO_PATH || edges[i].second == current)
+                continue;
+            unsigned int next_cost = current_cost + edges[i].first;
+            unordered_map<unsigned int, unsigned int>::iterator known = cost.find(edges[i].second);
+            if(known != cost.end() && known->second <= next_cost)
+                continue;
+            cost[edges[i].second] = next_cost;
+            parent[edges[i].second] = current;
+            frontier.push(entry(next_cost + heuristic(edges[i].second, goal), edges[i].second));
+        }
+    }
+
+    if(!found){
+        path.clear();
+        return NO_PATH;
+    }
+
+    vector<unsigned int> abstract_path;
+    for(unsigned int at = goal; at != start; at = parent[at])
+        abstract_path.push_back(at);
+    reverse(abstract_path.begin(), abstract_path.end());
+
+    unsigned int from = start;
+    for(unsigned int i = 0; i < abstract_path.size(); ++i){
+        refine(from, abstract_path[i], path);
+        from = abstract_path[i];
+    }
+    return path.size() - 1;
+}
+
+
+/* FUNCTION: Finds the cluster that holds a grid position.
+ * ARGUMENTS: The grid position.
+ * RETURN: The cluster id.
+ */
+template<class T>
+unsigned int hpagraph<T>::cluster_of(unsigned int position) const
+{
+    return (position / columns / cluster_size) * cluster_columns + (position % columns) / cluster_size;
+}
+
+
+/* FUNCTION: Computes the grid rectangle covered by a cluster. The bottom and right bounds are exclusive.
+ * ARGUMENTS: The cluster id and four references that receive its bounds.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void hpagraph<T>::cluster_bounds(unsigned int id, unsigned int & top, unsigned int & left, unsigned int & bottom, unsigned int & right) const
+{
+    top = (id / cluster_columns) * cluster_size;
+    left = (id % cluster_columns) * cluster_size;
+    bottom = min(top + cluster_size, rows);
+    right = min(left + cluster_size, columns);
+}
+
+
+/* FUNCTION: Recomputes the crossings on the border between a cluster and the cluster to its right.
+ * ARGUMENTS: The row and column of the cluster in the cluster grid.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void hpagraph<T>::build_vertical_border(unsigned int cluster_row, unsigned int cluster_column)
+{
+    if(cluster_column + 1 >= cluster_columns)
+        return;
+
+    unsigned int top, left, bottom, right;
+    cluster_bounds(cluster_row * cluster_columns + cluster_column, top, left, bottom, right);
+
+    vector<unsigned int> near, far;
+    for(unsigned int row = top; row < bottom; ++row){
+        near.push_back(row * columns + right - 1);
+        far.push_back(row * columns + right);
+    }
+    add_entrances(vertical_borders[cluster_row * cluster_columns + cluster_column], near, far);
+}
+
+
+/* FUNCTION: Recomputes the crossings on the border between a cluster and the cluster below it.
+ * ARGUMENTS: The row and column of the cluster in the cluster grid.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void hpagraph<T>::build_horizontal_border(unsigned int cluster_row, unsigned int cluster_column)
+{
+    if(cluster_row + 1 >= cluster_rows)
+        return;
+
+    unsigned int top, left, bottom, right;
+    cluster_bounds(cluster_row * cluster_columns + cluster_column, top, left, bottom, right);
+
+    vector<unsigned int> near, far;
+    for(unsigned int column = left; column < right; ++column){
+        near.push_back((bottom - 1) * columns + column);
+        far.push_back(bottom * columns + column);
+    }
+    add_entrances(horizontal_borders[cluster_row * cluster_columns + cluster_column], near, far);
+}
+
+
+/* FUNCTION: Places entrances along one border. Every maximal run of open crossings gets one entrance in
+ *           its middle, or one at each end if the run is long.
+ * ARGUMENTS: The border to fill with (near, far) pairs, and the cells on either side of the border in order.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void hpagraph<T>::add_entrances(vector<unsigned int> & border, const vector<unsigned int> & near, const vector<unsigned int> & far)
+{
+    border.clear();
+    unsigned int length = near.size();
+    unsigned int i = 0;
+    while(i < length)
+    {
+        if(!open[near[i]] || !open[far[i]]){
+            ++i;
+            continue;
+        }
+
+        unsigned int run_start = i;
+        while(i < length && open[near[i]] && open[far[i]])
+            ++i;
+        unsigned int run_length = i - run_start;
+
+        if(run_length < SHORT_ENTRANCE){
+            unsigned int middle = run_start + run_length / 2;
+            border.push_back(near[middle]);
+            border.push_back(far[middle]);
+        } else {
+            border.push_back(near[run_start]);
+            border.push_back(far[run_start]);
+            border.push_back(near[i - 1]);
+            border.push_back(far[i - 1]);
+        }
+    }
+}
+
+
+/* FUNCTION: Collects the entrances of a cluster from its four borders and caches the distance between
+ *           every pair of them, searching only inside the cluster.
+ * ARGUMENTS: The cluster id.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void hpagraph<T>::build_cluster(unsigned int id)
+{
+    cluster & target = clusters[id];
+    target.nodes.clear();
+    target.partners.clear();
+    target.dirty = false;
+
+    unsigned int cr = id / cluster_columns;
+    unsigned int cc = id % cluster_columns;
+    if(cc + 1 < cluster_columns)
+        add_border_nodes(target, vertical_borders[id], true);
+    if(cc > 0)
+        add_border_nodes(target, vertical_borders[id - 1], false);
+    if(cr + 1 < cluster_rows)
+        add_border_nodes(target, horizontal_borders[id], true);
+    if(cr > 0)
+        add_border_nodes(target, horizontal_borders[id - cluster_columns], false);
+
+    unsigned int count = target.nodes.size();
+    target.distances.assign(count * count, NO_PATH);
+
+    unsigned int top, left, bottom, right;
+    cluster_bounds(id, top, left, bottom, right);
+    unsigned int width = right - left;
+    for(unsigned int i = 0; i < count; ++i)
+    {
+        cluster_search(id, target.nodes[i]);
+        for(unsigned int j = 0; j < count; ++j)
+            target.distances[i * count + j] = local_distance[(target.nodes[j] / columns - top) * width + target.nodes[j] % columns - left];
+    }
+}
+
+
+/* FUNCTION: Adds the entrances on one side of a border to a cluster, along with the cell each one
+ *           crosses to.
+ * ARGUMENTS: The cluster, the border, and whether the cluster owns the near (first) side of each pair.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void hpagraph<T>::add_border_nodes(cluster & target, const vector<unsigned int> & border, bool first_side)
+{
+    for(unsigned int i = 0; i < border.size(); i += 2)
+    {
+        unsigned int mine = first_side ? border[i] : border[i + 1];
+        unsigned int theirs = first_side ? border[i + 1] : border[i];
+        unsigned int index = node_index(target, mine);
+        if(index == NO_PATH){
+            index = target.nodes.size();
+            target.nodes.push_back(mine);
+            target.partners.push_back(vector<unsigned int>());
+        }
+        target.partners[index].push_back(theirs);
+    }
+}
+
+
+/* FUNCTION: Looks up a grid position among the entrances of a cluster.
+ * ARGUMENTS: The cluster and the grid position.
+ * RETURN: The index of the entrance, or NO_PATH if the position is not an entrance.
+ */
+template<class T>
+unsigned int hpagraph<T>::node_index(const cluster & target, unsigned int position) const
+{
+    for(unsigned int i = 0; i < target.nodes.size(); ++i)
+        if(target.nodes[i] == position)
+            return i;
+    return NO_PATH;
+}
+
+
+/* FUNCTION: Breadth-first search that never leaves a cluster. Fills the local distance and parent
+ *           scratch arrays, which are indexed by position inside the cluster.
+ * ARGUMENTS: The cluster id and the grid position to search from.
+ * RETURN: Returns no values.
+ */
+template<class T>
+void hpagraph<T>::cluster_search(unsigned int id, unsigned int source)
+{
+    unsigned int top, left, bottom, right;
+    cluster_bounds(id, top, left, bottom, right);
+    unsigned int width = right - left;
+    unsigned int height = bottom - top;
+
+    fill(local_distance.begin(), local_distance.begin() + width * height, NO_PATH);
+
+    unsigned int head = 0, tail = 0;
+    unsigned int first = (source / columns - top) * width + source % columns - left;
+    local_distance[first] = 0;
+    local_parent[first] = first;
+    local_queue[tail++] = first;
+
+    while(head < tail)
+    {
+        unsigned int current = local_queue[head++];
+        unsigned int row = current / width;
+        unsigned int column = current % width;
+        unsigned int next_distance = local_distance[current] + 1;
+
+        unsigned int neighbours[4];
+        unsigned int count = 0;
+        if(column + 1 < width) neighbours[count++] = current + 1;
+        if(row > 0)            neighbours[count++] = current - width;
+        if(column > 0)         neighbours[count++] = current - 1;
+        if(row + 1 < height)   neighbours[count++] = current + width;
+
+        for(unsigned int i = 0; i < count; ++i)
+        {
+            unsigned int next = neighbours[i];
+            if(local_distance[next] != NO_PATH || !open[(top + next / width) * columns + left + next % width])
+                continue;
+            local_distance[next] = next_distance;
+            local_parent[next] = current;
+            local_queue[tail++] = next;
+        }
+    }
+}
+
+
+/* FUNCTION: Expands one abstract edge into grid steps and appends them to a path. The edge either
+ *           crosses a border between two adjacent cells, or stays inside one cluster.
+ * ARGUMENTS: The grid positions at either end of the edge and the path to append to.
+ * RETURN: True if the edge could be refined.
+ */
+template<class T>
+bool hpagraph<T>::refine(unsigned int from, unsigned int to, vector<unsigned int> & path)
+{
+    unsigned int id = cluster_of(from);
+    if(id != cluster_of(to)){
+        path.push_back(to);
+        return true;
+    }
+
+    cluster_search(id, from);
+    unsigned int top, left, bottom, right;
+    cluster_bounds(id, top, left, bottom, right);
+    unsigned int width = right - left;
+
+    unsigned int first = (from / columns - top) * width + from % columns - left;
+    unsigned int at = (to / columns - top) * width + to % columns - left;
+    if(local_distance[at] == NO_PATH)
+        return false;
+
+    unsigned int end = path.size();
+    while(at != first){
+        path.push_back((top + at / width) * columns + left + at % width);
+        at = local_parent[at];
+    }
+    reverse(path.begin() + end, path.end());
+    return true;
+}
+
+
+/* FUNCTION: Manhattan distance between two grid positions; admissible for 4-connected unit steps.
+ * ARGUMENTS: The two grid positions.
+ * RETURN: The estimated number of steps.
+ */
+template<class T>
+unsigned int hpagraph<T>::heuristic(unsigned int from, unsigned int to) const
+{
+    unsigned int from_row = from / columns, from_column = from % columns;
+    unsigned int to_row = to / columns, to_column = to % columns;
+    return (from_row > to_row ? from_row - to_row : to_row - from_row)
+         + (from_column > to_column ? from_column - to_column : to_column - from_column);
+}
+
+
+
+template class hpagraph<char>;
@@ -0,0 +1,86 @@
+//hpagraph.h
+
+/* Hierarchical pathfinding (HPA*) layer over a gridgraph. The grid is cut into square clusters of
+ * "cluster_size" cells per side. Where two neighbouring clusters share an open border, entrance
+ * vertices are placed on both sides of it, and the distances between the entrances of each cluster
+ * are cached. A long query is answered on this small abstract graph first and then refined into
+ * grid steps one cluster at a time. Larger clusters make the abstract graph smaller (faster queries)
+ * at the cost of less optimal paths; smaller clusters do the opposite. Movement is 4-connected, the
+ * same adjacency the gridgraph tabulates, and every step costs 1.
+ *
+ * The layer attaches to the grid as an observer, so every write marks the clusters whose cells
+ * changed passability dirty; they are recomputed before the next query. A mutex guards the
+ * abstract graph, so writes may come from other threads than the queries. */
+
+#ifndef HPAGRAPH_H
+#define HPAGRAPH_H
+
+#include "gridgraph.h"
+#include <vector>
+#include <mutex>
+
+
+const unsigned int DEFAULT_CLUSTER_SIZE = 16;
+
+template<class T>
+class hpagraph : public grid_observer<T>
+{
+    public:
+        hpagraph(gridgraph<T> & grid, typename gridgraph<T>::cell_predicate is_blocked, unsigned int cluster_size = DEFAULT_CLUSTER_SIZE);
+        ~hpagraph();
+
+        void value_changed(unsigned int row, unsigned int column, T old_value, T new_value);
+        void region_changed(unsigned int top, unsigned int left, unsigned int height, unsigned int width);
+        void rebuild_dirty(void); //recompute only the clusters touched since the last rebuild
+
+        unsigned int find_path(unsigned int start_row, unsigned int start_column,
+                               unsigned int goal_row, unsigned int goal_column, vector<unsigned int> & path);
+
+        unsigned int get_cluster_size(void) const { return cluster_size; }
+        unsigned int get_cluster_count(void) const { return cluster_rows * cluster_columns; }
+        unsigned int get_entrance_count(void) const;
+
+    private:
+        struct cluster
+        {
+            vector<unsigned int> nodes;                //grid positions of the entrance vertices
+            vector<unsigned int> distances;            //nodes.size() squared, NO_PATH if unreachable
+            vector< vector<unsigned int> > partners;   //entrances across the border from each node
+            bool dirty;
+        };
+
+        gridgraph<T> & grid;
+        typename gridgraph<T>::cell_predicate is_blocked;
+        vector<bool> open;
+        mutable mutex guard; //held by the observer hooks and by every query and rebuild
+
+        unsigned int rows;
+        unsigned int columns;
+        unsigned int cluster_size;
+        unsigned int cluster_rows;
+        unsigned int cluster_columns;
+
+        vector<cluster> clusters;
+        vector< vector<unsigned int> > vertical_borders;   //crossing pairs between (cr, cc) and (cr, cc + 1)
+        vector< vector<unsigned int> > horizontal_borders; //crossing pairs between (cr, cc) and (cr + 1, cc)
+
+        vector<unsigned int> local_distance; //scratch for searches inside one cluster
+        vector<unsigned int> local_parent;
+        vector<unsigned int> local_queue;
+
+        void cell_changed(unsigned int row, unsigned int column);
+        void rebuild_clusters(void);
+        unsigned int cluster_of(unsigned int position) const;
+        void cluster_bounds(unsigned int id, unsigned int & top, unsigned int & left, unsigned int & bottom, unsigned int & right) const;
+        void build_vertical_border(unsigned int cluster_row, unsigned int cluster_column);
+        void build_horizontal_border(unsigned int cluster_row, unsigned int cluster_column);
+        void add_entrances(vector<unsigned int> & border, const vector<unsigned int> & near, const vector<unsigned int> & far);
+        void build_cluster(unsigned int id);
+        void add_border_nodes(cluster & target, const vector<unsigned int> & border, bool first_side);
+        unsigned int node_index(const cluster & target, unsigned int position) const;
+        void cluster_search(unsigned int id, unsigned int source);
+        bool refine(unsigned int from, unsigned int to, vector<unsigned int> & path);
+        unsigned int heuristic(unsigned int from, unsigned int to) const;
+};
+
+#endif
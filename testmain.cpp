@@ -3,7 +3,21 @@
 /* Brandon Craig | brandonjcraig00 "at" gmail "dot" com */
 
 #include "gridgraph.h"
+#include "hpagraph.h"
+#include "batchquery.h"
+#include "gridaggregate.h"
+#include "gridpyramid.h"
+#include "griddelta.h"
+#include "gridexport.h"
+#include "gridcsr.h"
+#include "gridpartition.h"
 #include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <thread>
 
 
 
@@ -12,6 +26,22 @@ void ASSERT(string test_name, bool test_function) {cout << test_name << ": "; te
 bool test_coordinate_bounds(const gridgraph<char> & grid);
 bool test_vertex_coord_by_position(const gridgraph<char> & grid);
 bool test_vertex_position_by_coord(const gridgraph<char> & grid);
+bool test_hierarchical_paths(void);
+bool test_batch_queries(void);
+bool test_concurrent_access(void);
+bool test_storage_modes(void);
+bool test_lazy_grid(void);
+bool test_rectangle_aggregates(void);
+bool test_pyramid_levels(void);
+bool test_dirty_deltas(void);
+bool test_buffered_export(void);
+bool test_csr_adjacency(void);
+bool test_partitioned_grid(void);
+
+bool is_wall(char value) { return value == '#'; }
+void build_maze(gridgraph<char> & grid);
+unsigned int reference_distance(const gridgraph<char> & grid, unsigned int start, unsigned int goal);
+bool valid_path(const gridgraph<char> & grid, const vector<unsigned int> & path, unsigned int start, unsigned int goal);
 
 
 
@@ -22,6 +52,17 @@ int main()
 	ASSERT("Coordinates do not exceed bounds", test_coordinate_bounds(grid));
 	ASSERT("Each position matches its correct set of coordinates", test_vertex_position_by_coord(grid));
 	ASSERT("Each set of coordinates matches its correct position", test_vertex_coord_by_position(grid)); 	
+	ASSERT("Hierarchical paths are valid and follow cluster updates", test_hierarchical_paths());
+	ASSERT("Batched queries match a single-threaded search", test_batch_queries());
+	ASSERT("Concurrent region reads see whole writes and atomic adds add up", test_concurrent_access());
+	ASSERT("Arena, huge page and custom resource storage hold the same grid", test_storage_modes());
+	ASSERT("Lazy grids only allocate the tiles that were written", test_lazy_grid());
+	ASSERT("Summed-area and Fenwick rectangle sums follow grid writes", test_rectangle_aggregates());
+	ASSERT("Pyramid blocks match the cells under them after writes", test_pyramid_levels());
+	ASSERT("Deltas since a version keep replicas in sync", test_dirty_deltas());
+	ASSERT("Exports match the display listing in every format and thread count", test_buffered_export());
+	ASSERT("CSR adjacency matches the open neighbours of every cell", test_csr_adjacency());
+	ASSERT("Partitioned stencils and searches match a single process", test_partitioned_grid());
 
 	return 0;
 
@@ -105,3 +146,772 @@ bool test_coordinate_bounds(const gridgraph<char> & grid)
 
 }
 
+
+
+/* Fills a grid with open cells and a few walls that have narrow gaps, so paths must detour. */
+void build_maze(gridgraph<char> & grid)
+{
+	unsigned int rows = grid.get_column_size();
+	unsigned int columns = grid.get_row_size();
+	vector<char> values(grid.get_size(), '.');
+
+	for(unsigned int i = 0; i < rows; ++i)
+	{
+		if(i != 3)
+			values[i * columns + columns / 3] = '#';
+		if(i != rows - 4)
+			values[i * columns + 2 * columns / 3] = '#';
+	}
+	for(unsigned int j = columns / 3; j < columns; ++j)
+		if(j != columns - 2)
+			values[(rows / 2) * columns + j] = '#';
+
+	grid.set_all_values(values.data());
+}
+
+
+
+/* Plain breadth-first search over the whole grid, used as the reference for the faster searches. */
+unsigned int reference_distance(const gridgraph<char> & grid, unsigned int start, unsigned int goal)
+{
+	unsigned int rows = grid.get_column_size();
+	unsigned int columns = grid.get_row_size();
+	vector<char> values(grid.get_size());
+	grid.get_all_values(values.data());
+	if(is_wall(values[start]) || is_wall(values[goal]))
+		return NO_PATH;
+
+	vector<unsigned int> distance(grid.get_size(), NO_PATH);
+	vector<unsigned int> queue(1, start);
+	distance[start] = 0;
+	for(unsigned int head = 0; head < queue.size(); ++head)
+	{
+		unsigned int current = queue[head];
+		unsigned int row = current / columns, column = current % columns;
+		unsigned int next[4] = {current + 1, current - columns, current - 1, current + columns};
+		bool inside[4] = {column + 1 < columns, row > 0, column > 0, row + 1 < rows};
+		for(unsigned int k = 0; k < 4; ++k)
+			if(inside[k] && !is_wall(values[next[k]]) && distance[next[k]] == NO_PATH){
+				distance[next[k]] = distance[current] + 1;
+				queue.push_back(next[k]);
+			}
+	}
+	return distance[goal];
+}
+
+
+
+/* Checks that a path runs from start to goal through open cells in 4-connected steps. */
+bool valid_path(const gridgraph<char> & grid, const vector<unsigned int> & path, unsigned int start, unsigned int goal)
+{
+	unsigned int columns = grid.get_row_size();
+	if(path.empty() || path.front() != start || path.back() != goal)
+		return false;
+
+	for(unsigned int i = 0; i < path.size(); ++i)
+	{
+		if(is_wall(grid.get_value_at_cord(path[i] / columns, path[i] % columns)))
+			return false;
+		if(i == 0)
+			continue;
+		unsigned int a = path[i - 1], b = path[i];
+		unsigned int row_step = a / columns > b / columns ? a / columns - b / columns : b / columns - a / columns;
+		unsigned int column_step = a % columns > b % columns ? a % columns - b % columns : b % columns - a % columns;
+		if(row_step + column_step != 1)
+			return false;
+	}
+	return true;
+}
+
+
+
+bool test_hierarchical_paths(void)
+{
+	gridgraph<char> grid(37, 41);
+	build_maze(grid);
+	unsigned int rows = grid.get_column_size();
+	unsigned int columns = grid.get_row_size();
+
+	hpagraph<char> hpa(grid, is_wall, 8);
+	vector<unsigned int> path;
+	unsigned int pairs[4][4] = {{0, 0, rows - 1, columns - 1}, {rows - 1, 0, 0, columns - 1}, {2, 2, 5, 6}, {rows / 2 + 1, columns - 1, 0, 0}};
+
+	for(unsigned int k = 0; k < 4; ++k)
+	{
+		unsigned int start = pairs[k][0] * columns + pairs[k][1];
+		unsigned int goal = pairs[k][2] * columns + pairs[k][3];
+		unsigned int expected = reference_distance(grid, start, goal);
+		unsigned int length = hpa.find_path(pairs[k][0], pairs[k][1], pairs[k][2], pairs[k][3], path);
+		if(expected == NO_PATH ? length != NO_PATH : (length < expected || !valid_path(grid, path, start, goal)))
+			return false;
+	}
+
+	//close the only gap in the middle wall; only the touched clusters are rebuilt
+	grid.set_value_at_cord('#', rows / 2, columns - 2);
+	if(hpa.find_path(0, columns - 1, rows - 1, columns - 1, path) != reference_distance(grid, columns - 1, rows * columns - 1))
+		return false;
+
+	char gap = '.';
+	grid.set_region_values(&gap, rows / 2, columns - 2, 1, 1);
+	unsigned int length = hpa.find_path(0, columns - 1, rows - 1, columns - 1, path);
+	return length != NO_PATH && valid_path(grid, path, columns - 1, rows * columns - 1);
+}
+
+
+
+void count_completion(unsigned int index, const query_result & result, void * context) { ++*(atomic<unsigned int> *) context; }
+
+bool test_batch_queries(void)
+{
+	gridgraph<char> grid(29, 33);
+	build_maze(grid);
+	unsigned int size = grid.get_size();
+
+	vector<grid_query> queries;
+	for(unsigned int i = 0; i < 200; ++i){
+		grid_query next = {(i * 7919) % size, (i * 104729 + 13) % size, i % 3 ? QUERY_PATH : QUERY_REACHABLE};
+		queries.push_back(next);
+	}
+
+	batch_scheduler<char> scheduler(grid, is_wall, 4);
+	vector<query_result> results;
+	batch_stats stats = scheduler.run_batch(queries, results);
+	if(stats.queries != queries.size() || stats.max_latency < stats.median_latency)
+		return false;
+
+	for(unsigned int i = 0; i < queries.size(); ++i)
+	{
+		unsigned int expected = reference_distance(grid, queries[i].source, queries[i].target);
+		if(results[i].reachable != (expected != NO_PATH) || results[i].length != expected)
+			return false;
+		if(queries[i].mode == QUERY_PATH && results[i].reachable && !valid_path(grid, results[i].path, queries[i].source, queries[i].target))
+			return false;
+	}
+
+	atomic<unsigned int> completed(0);
+	batch_handle handle = scheduler.submit_batch(queries, count_completion, &completed);
+	stats = handle.wait();
+	return completed == queries.size() && handle.result(queries.size() - 1).get().length == results.back().length;
+}
+
+
+
+bool test_concurrent_access(void)
+{
+	gridgraph<char> grid(20, 20);
+	vector<char> zeros(grid.get_size(), 0);
+	grid.set_all_values(zeros.data());
+	grid.enable_concurrency(4);
+
+	//writers fill a block that straddles four tiles with one value; readers must never see a mix
+	atomic<bool> torn(false);
+	vector<thread> threads;
+	for(unsigned int w = 0; w < 2; ++w)
+		threads.push_back(thread([&grid, w]{
+			for(unsigned int i = 0; i < 2000; ++i){
+				vector<char> block(16, (char) (w * 64 + i % 50));
+				grid.set_region_values(block.data(), 2, 2, 4, 4);
+			}
+		}));
+	for(unsigned int r = 0; r < 2; ++r)
+		threads.push_back(thread([&grid, &torn]{
+			for(unsigned int i = 0; i < 2000; ++i){
+				char block[16];
+				grid.get_region_values(block, 2, 2, 4, 4);
+				for(unsigned int k = 1; k < 16; ++k)
+					if(block[k] != block[0])
+						torn = true;
+			}
+		}));
+	for(unsigned int t = 0; t < 4; ++t)
+		threads.push_back(thread([&grid]{
+			for(unsigned int i = 0; i < 50; ++i)
+				grid.fetch_add_at_cord(1, 10, 10);
+		}));
+	for(unsigned int t = 0; t < threads.size(); ++t)
+		threads[t].join();
+
+	char expected = 0;
+	bool swapped = grid.compare_exchange_at_cord(expected, 1, 0, 0) && grid.atomic_load_at_cord(0, 0) == 1;
+	if(torn || (unsigned char) grid.get_value_at_cord(10, 10) != 200 || !swapped)
+		return false;
+
+	//atomic adds to two cells in different tiles, always the first cell before the second: a snapshot
+	//of both must never show the second ahead of the first
+	atomic<bool> done(false), reordered(false);
+	thread adder([&grid, &done]{
+		for(unsigned int i = 0; i < 100; ++i){
+			grid.fetch_add_at_cord(1, 16, 3);
+			grid.fetch_add_at_cord(1, 16, 4);
+		}
+		done = true;
+	});
+	thread reader([&grid, &done, &reordered]{
+		while(!done){
+			char pair[2];
+			grid.get_region_values(pair, 16, 3, 1, 2);
+			if(pair[0] != pair[1] && pair[0] != pair[1] + 1)
+				reordered = true;
+		}
+	});
+	adder.join();
+	reader.join();
+	if(reordered)
+		return false;
+
+	//whole-grid reads must finish while a writer keeps every tile busy
+	gridgraph<char> busy(200, 200);
+	busy.enable_concurrency(8);
+	atomic<bool> stop(false);
+	atomic<unsigned int> writes(0);
+	thread writer([&busy, &stop, &writes]{
+		for(unsigned int i = 0; !stop; ++i, ++writes)
+			busy.set_value_at_cord((char) i, (i * 7919) % 200, (i * 104729) % 200);
+	});
+	vector<char> snapshot(busy.get_size());
+	while(writes < 1000)
+		;
+	for(unsigned int i = 0; i < 20; ++i)
+		busy.get_all_values(snapshot.data());
+	stop = true;
+	writer.join();
+	return true;
+}
+
+
+
+/* Counts the allocations made through it and hands them to the default resource. */
+class counting_resource : public std::pmr::memory_resource
+{
+	public:
+		unsigned int allocations;
+		counting_resource() : allocations(0) {}
+	protected:
+		void * do_allocate(size_t bytes, size_t alignment) { ++allocations; return std::pmr::get_default_resource()->allocate(bytes, alignment); }
+		void do_deallocate(void * pointer, size_t bytes, size_t alignment) { std::pmr::get_default_resource()->deallocate(pointer, bytes, alignment); }
+		bool do_is_equal(const std::pmr::memory_resource & other) const noexcept { return this == &other; }
+};
+
+bool test_storage_modes(void)
+{
+	gridgraph<char> heap(13, 17);
+	build_maze(heap);
+	vector<char> expected(heap.get_size());
+	heap.get_all_values(expected.data());
+
+	counting_resource counter;
+	bool passing = true;
+	{
+		gridgraph<char> arena(13, 17, STORAGE_ARENA);
+		gridgraph<char> huge(13, 17, STORAGE_HUGE_PAGES);
+		gridgraph<char> counted(13, 17, &counter);
+		passing = counter.allocations == 2;
+
+		gridgraph<char> * grids[3] = {&arena, &huge, &counted};
+		for(unsigned int g = 0; g < 3 && passing; ++g)
+		{
+			build_maze(*grids[g]);
+			gridgraph<char> copy(*grids[g]);
+			vector<char> found(copy.get_size());
+			copy.get_all_values(found.data());
+			//a copy gets its own arena, but shares a caller-supplied resource
+			passing = found == expected && (copy.get_resource() == &counter) == (g == 2);
+		}
+	}
+	return passing;
+}
+
+
+
+bool test_lazy_grid(void)
+{
+	//a 2.5 billion cell grid is only affordable because almost none of it is touched (17 tiles)
+	gridgraph<char> huge(50000, 50000, STORAGE_LAZY, '.');
+	for(unsigned int i = 0; i < 1000; ++i)
+		huge.set_value_at_cord('#', 20000 + i, 30000);
+	huge.set_value_at_cord('.', 0, 0);
+	if(huge.get_materialized_tiles() != 17 || huge.get_value_at_cord(20500, 30000) != '#' || huge.get_value_at_cord(49999, 49999) != '.')
+		return false;
+
+	gridgraph<char> copy(huge);
+	unsigned int row, column;
+	if(!copy.is_lazy() || copy.get_materialized_tiles() != 17 || copy.get_value_at_cord(20999, 30000) != '#'
+			|| !copy.get_coordinate_by_position(50000 * 7 + 3, row, column) || row != 7 || column != 3)
+		return false;
+
+	//bulk writes skip tiles that only hold the default, and materializing keeps every value
+	gridgraph<char> lazy(150, 130, STORAGE_LAZY, '.');
+	gridgraph<char> eager(150, 130);
+	build_maze(eager);
+	vector<char> values(eager.get_size());
+	eager.get_all_values(values.data());
+	lazy.set_all_values(values.data());
+	lazy.set_all_values(values.data());
+	unsigned int written = lazy.get_materialized_tiles();
+
+	//a lazy grid lists the same vertices as an eager one, without building any
+	ostringstream eager_listing, lazy_listing;
+	eager.display_vertices(eager_listing);
+	lazy.display_vertices(lazy_listing);
+	if(lazy_listing.str() != eager_listing.str() || !lazy.is_lazy())
+		return false;
+
+	lazy.materialize();
+	vector<char> found(lazy.get_size());
+	lazy.get_all_values(found.data());
+	if(written != 7 || lazy.is_lazy() || found != values)
+		return false;
+
+	//concurrent mode keeps a grid lazy, and threads may create tiles side by side
+	gridgraph<char> shared(256, 256, STORAGE_LAZY, 0);
+	shared.enable_concurrency(16);
+	vector<thread> threads;
+	for(unsigned int t = 0; t < 4; ++t)
+		threads.push_back(thread([&shared]{
+			for(unsigned int i = 0; i < 16; ++i)
+				for(unsigned int tile = 0; tile < 16; ++tile)
+					shared.fetch_add_at_cord(1, tile / 4 * 64 + i, tile % 4 * 64);
+		}));
+	for(unsigned int t = 0; t < threads.size(); ++t)
+		threads[t].join();
+	if(!shared.is_lazy() || shared.get_materialized_tiles() != 16 || shared.get_value_at_cord(192 + 15, 192) != 4)
+		return false;
+
+	//positions are unsigned ints, so a grid with more cells than that is refused
+	try{
+		gridgraph<char> too_big(70000, 70000, STORAGE_LAZY);
+		return false;
+	}
+	catch(const length_error &){
+		return true;
+	}
+}
+
+
+
+bool test_rectangle_aggregates(void)
+{
+	gridgraph<char> grid(23, 31);
+	unsigned int rows = grid.get_column_size(), columns = grid.get_row_size();
+	vector<char> values(grid.get_size());
+	for(unsigned int i = 0; i < values.size(); ++i)
+		values[i] = (char) ((i * 37) % 11 == 0 ? '#' : (i * 13) % 9);
+	grid.set_all_values(values.data());
+
+	summed_area_table<char> table(grid, is_wall, 3);
+	fenwick_index<char> tree(grid, is_wall);
+
+	for(unsigned int step = 0; step < 60; ++step)
+	{
+		//mix single writes, atomic adds and small region writes between queries
+		unsigned int row = (step * 7) % rows, column = (step * 11) % columns;
+		if(step % 3 == 0)
+			grid.set_value_at_cord(step % 5 ? (char) step : '#', row, column);
+		else if(step % 3 == 1)
+			grid.fetch_add_at_cord(3, row, column);
+		else {
+			char block[6] = {1, '#', 2, 3, '#', 4};
+			grid.set_region_values(block, row % (rows - 2), column % (columns - 3), 2, 3);
+		}
+
+		unsigned int top = (step * 5) % rows, left = (step * 3) % columns;
+		unsigned int height = 1 + step % 9, width = 1 + (step * 2) % 13;
+		long long sum = 0;
+		unsigned int walls = 0;
+		for(unsigned int i = top; i < min(top + height, rows); ++i)
+			for(unsigned int j = left; j < min(left + width, columns); ++j){
+				sum += grid.get_value_at_cord(i, j);
+				walls += is_wall(grid.get_value_at_cord(i, j));
+			}
+
+		if(table.rect_sum(top, left, height, width) != sum || tree.rect_sum(top, left, height, width) != sum
+				|| table.rect_matching(top, left, height, width) != walls || tree.rect_matching(top, left, height, width) != walls
+				|| table.rect_count(top, left, height, width) != tree.rect_count(top, left, height, width))
+			return false;
+	}
+
+	//writers on separate threads, with queries (and so lazy rebuilds) running alongside them
+	gridgraph<char> shared(40, 40);
+	vector<char> zeros(shared.get_size(), 0);
+	shared.set_all_values(zeros.data());
+	shared.enable_concurrency(8);
+	summed_area_table<char> shared_table(shared, is_wall, 2);
+	fenwick_index<char> shared_tree(shared, is_wall);
+	vector<thread> threads;
+	for(unsigned int w = 0; w < 4; ++w)
+		threads.push_back(thread([&shared, w]{
+			for(unsigned int i = 0; i < 300; ++i){
+				unsigned int row = (i * 7 + w) % 40, column = (i * 3) % 40;
+				shared.set_value_at_cord(i % 5 ? (char) (i + w) : '#', 5, 5); //every writer contends for one cell
+				if(i % 3 == 0)
+					shared.set_value_at_cord(i % 4 ? (char) (i % 9) : '#', row, column);
+				else if(i % 3 == 1)
+					shared.fetch_add_at_cord(1, row, column);
+				else {
+					char block[4] = {(char) w, '#', 2, (char) i};
+					shared.set_region_values(block, row % 39, column % 39, 2, 2);
+				}
+			}
+		}));
+	for(unsigned int q = 0; q < 2; ++q)
+		threads.push_back(thread([&shared_table, &shared_tree]{
+			for(unsigned int i = 0; i < 300; ++i){
+				shared_table.rect_sum(i % 40, 0, 10, 40);
+				shared_tree.rect_matching(0, i % 40, 40, 10);
+			}
+		}));
+	for(unsigned int t = 0; t < threads.size(); ++t)
+		threads[t].join();
+
+	long long total = 0;
+	unsigned int total_walls = 0;
+	for(unsigned int i = 0; i < 40; ++i)
+		for(unsigned int j = 0; j < 40; ++j){
+			total += shared.get_value_at_cord(i, j);
+			total_walls += is_wall(shared.get_value_at_cord(i, j));
+		}
+	return shared_table.rect_sum(0, 0, 40, 40) == total && shared_tree.rect_sum(0, 0, 40, 40) == total
+		&& shared_table.rect_matching(0, 0, 40, 40) == total_walls && shared_tree.rect_matching(0, 0, 40, 40) == total_walls;
+}
+
+
+
+bool test_pyramid_levels(void)
+{
+	gridgraph<char> grid(37, 45);
+	unsigned int rows = grid.get_column_size(), columns = grid.get_row_size();
+	build_maze(grid);
+
+	grid_pyramid<char> walls(grid, PYRAMID_ANY, is_wall, 3);
+	grid_pyramid<char> sums(grid, PYRAMID_SUM);
+	grid_pyramid<char> lowest(grid, PYRAMID_MIN);
+	if(walls.get_level_rows(walls.get_level_count() - 1) != 1 || walls.get_level_columns(walls.get_level_count() - 1) != 1)
+		return false;
+
+	for(unsigned int step = 0; step < 40; ++step)
+	{
+		unsigned int row = (step * 7) % rows, column = (step * 13) % columns;
+		if(step % 2)
+			grid.set_value_at_cord(step % 3 ? '.' : '#', row, column);
+		else {
+			char block[4] = {'#', '.', '.', (char) step};
+			grid.set_region_values(block, row % (rows - 1), column % (columns - 1), 2, 2);
+		}
+
+		//every block of every level against the cells it covers
+		for(unsigned int level = 1; level < walls.get_level_count(); ++level)
+			for(unsigned int r = 0; r < walls.get_level_rows(level); ++r)
+				for(unsigned int c = 0; c < walls.get_level_columns(level); ++c)
+				{
+					bool blocked = false;
+					long long sum = 0, low = 127;
+					for(unsigned int i = r << level; i < min((r + 1) << level, rows); ++i)
+						for(unsigned int j = c << level; j < min((c + 1) << level, columns); ++j){
+							char value = grid.get_value_at_cord(i, j);
+							blocked = blocked || is_wall(value);
+							sum += value;
+							low = min(low, (long long) value);
+						}
+					if(walls.any_blocked(level, r, c) != blocked || sums.block_value(level, r, c) != sum || lowest.block_value(level, r, c) != low)
+						return false;
+				}
+
+		unsigned int top = (step * 5) % rows, left = (step * 3) % columns;
+		unsigned int height = 1 + step % 11, width = 1 + (step * 2) % 17;
+		bool blocked = false;
+		for(unsigned int i = top; i < min(top + height, rows); ++i)
+			for(unsigned int j = left; j < min(left + width, columns); ++j)
+				blocked = blocked || is_wall(grid.get_value_at_cord(i, j));
+		if(walls.any_blocked_in(top, left, height, width) != blocked)
+			return false;
+	}
+
+	//writers on separate threads while other threads search the pyramid
+	gridgraph<char> shared(40, 40);
+	vector<char> zeros(shared.get_size(), 0);
+	shared.set_all_values(zeros.data());
+	shared.enable_concurrency(8);
+	grid_pyramid<char> shared_sums(shared, PYRAMID_SUM, NULL, 2);
+	grid_pyramid<char> shared_walls(shared, PYRAMID_ANY, is_wall, 2);
+	vector<thread> threads;
+	for(unsigned int w = 0; w < 4; ++w)
+		threads.push_back(thread([&shared, w]{
+			for(unsigned int i = 0; i < 300; ++i){
+				unsigned int row = (i * 7 + w) % 40, column = (i * 3) % 40;
+				if(i % 2)
+					shared.set_value_at_cord(i % 5 ? (char) (i % 7) : '#', row, column);
+				else {
+					char block[4] = {(char) w, '#', 1, (char) (i % 3)};
+					shared.set_region_values(block, row % 39, column % 39, 2, 2);
+				}
+			}
+		}));
+	for(unsigned int q = 0; q < 2; ++q)
+		threads.push_back(thread([&shared_walls, &shared_sums]{
+			for(unsigned int i = 0; i < 300; ++i){
+				shared_walls.any_blocked_in(i % 40, 0, 5, 40);
+				shared_sums.block_value(2, i % 10, 0);
+			}
+		}));
+	for(unsigned int t = 0; t < threads.size(); ++t)
+		threads[t].join();
+
+	long long total = 0;
+	bool any_wall = false;
+	for(unsigned int i = 0; i < 40; ++i)
+		for(unsigned int j = 0; j < 40; ++j){
+			total += shared.get_value_at_cord(i, j);
+			any_wall = any_wall || is_wall(shared.get_value_at_cord(i, j));
+		}
+	unsigned int top_level = shared_sums.get_level_count() - 1;
+	return shared_sums.block_value(top_level, 0, 0) == total && shared_walls.any_blocked_in(0, 0, 40, 40) == any_wall;
+}
+
+
+
+bool test_dirty_deltas(void)
+{
+	gridgraph<char> grid(50, 70);
+	unsigned int rows = grid.get_column_size(), columns = grid.get_row_size();
+	build_maze(grid);
+
+	dirty_tracker<char> tracker(grid);
+	gridgraph<char> early(grid), late(grid);
+	vector< grid_patch<char> > patches;
+
+	//nothing written yet: both kinds of delta are empty
+	unsigned long long early_version = tracker.get_delta(0, patches);
+	if(!patches.empty() || tracker.take_delta(patches) != early_version || !patches.empty())
+		return false;
+
+	//one write is one tile-sized patch
+	grid.set_value_at_cord('#', 20, 33);
+	if(tracker.get_dirty_count() != 1 || tracker.take_delta(patches) != tracker.get_version() || patches.size() != 1
+			|| patches[0].top != 16 || patches[0].left != 32 || patches[0].height != DELTA_TILE_SIZE || patches[0].width != DELTA_TILE_SIZE)
+		return false;
+	dirty_tracker<char>::apply_delta(late, patches);
+	unsigned long long late_version = tracker.get_version();
+
+	for(unsigned int step = 0; step < 30; ++step)
+	{
+		unsigned int row = (step * 17) % rows, column = (step * 29) % columns;
+		if(step % 3 == 0)
+			grid.set_value_at_cord((char) ('a' + step), row, column);
+		else if(step % 3 == 1)
+			grid.fetch_add_at_cord(1, row, column);
+		else {
+			char block[12] = {'#', '#', '#', '#', '.', '.', '.', '.', 'x', 'x', 'x', 'x'};
+			grid.set_region_values(block, row % (rows - 3), column % (columns - 4), 3, 4);
+		}
+
+		//"late" syncs every step with the marks, "early" every tenth step by version
+		patches.clear();
+		late_version = tracker.take_delta(patches);
+		dirty_tracker<char>::apply_delta(late, patches);
+		if(step % 10 == 9){
+			patches.clear();
+			early_version = tracker.get_delta(early_version, patches);
+			dirty_tracker<char>::apply_delta(early, patches);
+		}
+		if(tracker.get_dirty_count() != 0 || late_version != tracker.get_version())
+			return false;
+	}
+
+	for(unsigned int i = 0; i < rows; ++i)
+		for(unsigned int j = 0; j < columns; ++j)
+			if(late.get_value_at_cord(i, j) != grid.get_value_at_cord(i, j) || early.get_value_at_cord(i, j) != grid.get_value_at_cord(i, j))
+				return false;
+
+	//a bulk write marks every tile
+	vector<char> values(grid.get_size(), '.');
+	grid.set_all_values(values.data());
+	return tracker.get_dirty_count() == ((rows + 15) / 16) * ((columns + 15) / 16);
+}
+
+
+
+bool test_buffered_export(void)
+{
+	//enough cells for several bands of rows
+	gridgraph<char> grid(130, 600);
+	unsigned int rows = grid.get_column_size(), columns = grid.get_row_size();
+	build_maze(grid);
+	grid.set_value_at_cord(-5, 3, 4);
+
+	ostringstream listing;
+	grid.display_vertices(listing);
+
+	string serial[4];
+	for(unsigned int threads = 1; threads <= 3; threads += 2)
+	{
+		grid_exporter<char> exporter(grid, threads);
+		ostringstream text, csv, pgm, edges;
+		if(!exporter.write_adjacency(text, EXPORT_TEXT) || !exporter.write_values(csv, EXPORT_CSV)
+				|| !exporter.write_values(pgm, EXPORT_PGM) || !exporter.write_adjacency(edges, EXPORT_EDGES)
+				|| exporter.write_values(edges, EXPORT_EDGES) || exporter.write_adjacency(pgm, EXPORT_PPM))
+			return false;
+		if(text.str() != listing.str())
+			return false;
+
+		//the same bytes whichever way the bands were formatted
+		string outputs[4] = {text.str(), csv.str(), pgm.str(), edges.str()};
+		for(unsigned int i = 0; i < 4; ++i){
+			if(threads == 1)
+				serial[i] = outputs[i];
+			else if(serial[i] != outputs[i])
+				return false;
+		}
+	}
+
+	//spot-check the values and the sizes of the other formats
+	istringstream csv(serial[1]);
+	string line;
+	for(unsigned int i = 0; i < 4; ++i)
+		getline(csv, line);
+	if(line.compare(0, 11, "46,46,46,46") != 0 || serial[1].find("\n46,46,46,46,-5,46") == string::npos)
+		return false;
+
+	string header = "P5\n600 130\n255\n";
+	if(serial[2].compare(0, header.size(), header) != 0 || serial[2].size() != header.size() + rows * columns
+			|| serial[2][header.size() + 3 * columns + 4] != (char) -5)
+		return false;
+
+	unsigned int edges = 2 * (rows * (columns - 1) + columns * (rows - 1));
+	if((unsigned int) count(serial[3].begin(), serial[3].end(), '\n') != edges || serial[3].compare(0, 10, "0 600\n0 1\n") != 0)
+		return false;
+
+	//a lazy grid lists the same structure
+	gridgraph<char> lazy(rows, columns, STORAGE_LAZY);
+	ostringstream lazy_text;
+	grid_exporter<char>(lazy, 2).write_adjacency(lazy_text, EXPORT_TEXT);
+	return lazy_text.str() == listing.str();
+}
+
+
+
+double step_cost(char from, char to) { return 1 + (to == 'x'); }
+
+bool test_csr_adjacency(void)
+{
+	gridgraph<char> grid(150, 90);
+	unsigned int rows = grid.get_column_size(), columns = grid.get_row_size();
+	build_maze(grid);
+	grid.set_value_at_cord('x', 5, 5);
+
+	csr_adjacency<char> serial(grid, CONNECT_4, is_wall, NULL, 1);
+	csr_adjacency<char> banded(grid, CONNECT_4, is_wall, NULL, 3);
+	if(serial.get_offsets() != banded.get_offsets() || serial.get_neighbours() != banded.get_neighbours() || !serial.get_weights().empty())
+		return false;
+
+	//a breadth-first search over the CSR arrays finds the same distances as over the grid
+	const vector<size_t> & offsets = serial.get_offsets();
+	const vector<unsigned int> & neighbours = serial.get_neighbours();
+	unsigned int goal = grid.get_size() - 1;
+	vector<unsigned int> distance(grid.get_size(), NO_PATH);
+	vector<unsigned int> frontier(1, 0);
+	distance[0] = 0;
+	for(unsigned int i = 0; i < frontier.size(); ++i)
+		for(size_t edge = offsets[frontier[i]]; edge < offsets[frontier[i] + 1]; ++edge)
+			if(distance[neighbours[edge]] == NO_PATH){
+				distance[neighbours[edge]] = distance[frontier[i]] + 1;
+				frontier.push_back(neighbours[edge]);
+			}
+	if(distance[goal] != reference_distance(grid, 0, goal))
+		return false;
+
+	//8-connected: sorted, symmetric, no corner cutting, and weighted by the cell moved into
+	csr_adjacency<char> diagonal(grid, CONNECT_8, is_wall, step_cost, 3);
+	const vector<size_t> & offsets8 = diagonal.get_offsets();
+	const vector<unsigned int> & neighbours8 = diagonal.get_neighbours();
+	const vector<double> & weights = diagonal.get_weights();
+	if(diagonal.get_vertex_count() != rows * columns || weights.size() != diagonal.get_edge_count())
+		return false;
+	for(unsigned int v = 0; v < rows * columns; ++v)
+		for(size_t edge = offsets8[v]; edge < offsets8[v + 1]; ++edge)
+		{
+			unsigned int u = neighbours8[edge];
+			int dr = (int) (u / columns) - (int) (v / columns), dc = (int) (u % columns) - (int) (v % columns);
+			if((edge > offsets8[v] && neighbours8[edge - 1] >= u) || abs(dr) > 1 || abs(dc) > 1
+					|| is_wall(grid.get_value_at_cord(v / columns, v % columns)) || is_wall(grid.get_value_at_cord(u / columns, u % columns))
+					|| (dr && dc && (is_wall(grid.get_value_at_cord(u / columns, v % columns)) || is_wall(grid.get_value_at_cord(v / columns, u % columns))))
+					|| !binary_search(neighbours8.begin() + offsets8[u], neighbours8.begin() + offsets8[u + 1], v))
+				return false;
+			double expected = step_cost(0, grid.get_value_at_cord(u / columns, u % columns)) * (dr && dc ? M_SQRT2 : 1.0);
+			if(weights[edge] != expected)
+				return false;
+		}
+	return diagonal.get_degree(columns + 1) == 8 && diagonal.get_degree(0) == 3;
+}
+
+
+
+char mix(char center, char up, char down, char left, char right) { return (char) ((center * 3 + up + down + left + right) % 61 + 30); }
+
+bool test_partitioned_grid(void)
+{
+	gridgraph<char> grid(45, 61);
+	unsigned int rows = grid.get_column_size(), columns = grid.get_row_size();
+	build_maze(grid);
+	grid.set_value_at_cord('#', 0, 1);
+
+	//the single-process answer: five stencil steps with '#' outside the grid
+	vector<char> expected(grid.get_size()), scratch(grid.get_size());
+	grid.get_all_values(expected.data());
+	for(unsigned int step = 0; step < 5; ++step)
+	{
+		for(unsigned int i = 0; i < rows; ++i)
+			for(unsigned int j = 0; j < columns; ++j){
+				unsigned int cell = i * columns + j;
+				scratch[cell] = mix(expected[cell], i ? expected[cell - columns] : '#', i + 1 < rows ? expected[cell + columns] : '#',
+				                    j ? expected[cell - 1] : '#', j + 1 < columns ? expected[cell + 1] : '#');
+			}
+		expected.swap(scratch);
+	}
+
+	unsigned int layouts[3][2] = {{1, 1}, {3, 2}, {4, 5}};
+	for(unsigned int layout = 0; layout < 3; ++layout)
+	{
+		partitioned_grid<char> split(rows, columns, layouts[layout][0], layouts[layout][1]);
+		if(!split.good() || split.get_block_count() != layouts[layout][0] * layouts[layout][1])
+			return false;
+
+		//searches from a corner, before and after moving the cuts
+		split.load(grid);
+		vector<unsigned int> distance(grid.get_size());
+		for(unsigned int round = 0; round < 2; ++round)
+		{
+			unsigned int reached = split.distances(0, 0, is_wall, distance.data());
+			unsigned int counted = 0;
+			for(unsigned int cell = 0; cell < grid.get_size(); ++cell){
+				counted += distance[cell] != NO_PATH;
+				if(cell % 7 == 0 && distance[cell] != reference_distance(grid, 0, cell))
+					return false;
+			}
+			if(reached != counted || split.distances(0, 1, is_wall, NULL) != 0)
+				return false;
+			split.rebalance();
+		}
+
+		//the blocks still tile the grid exactly once
+		unsigned int area = 0;
+		for(unsigned int block = 0; block < split.get_block_count(); ++block){
+			unsigned int top, left, height, width;
+			split.get_block(block, top, left, height, width);
+			if(height == 0 || width == 0 || top + height > rows || left + width > columns || split.get_block_cost(block) != 0)
+				return false;
+			area += height * width;
+		}
+		if(area != rows * columns)
+			return false;
+
+		split.step(mix, 3, '#');
+		split.step(mix, 2, '#');
+		gridgraph<char> result(rows, columns);
+		split.store(result);
+		vector<char> values(grid.get_size());
+		result.get_all_values(values.data());
+		if(values != expected || split.get_value_at_cord(7, 9) != expected[7 * columns + 9])
+			return false;
+	}
+	return true;
+}